@@ -16,16 +16,134 @@ const byte payloadLengthMaxDefault = 80;
 
 const byte queueDoubleDecimalPlacesDefault = 3;
 
+const unsigned long powersOf10[] PROGMEM = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};  //used by the value_t number conversion
+const byte powersOf10Count = sizeof(powersOf10) / sizeof(powersOf10[0]);
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //constructor
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-EtherEventQueueClass::EtherEventQueueClass() {
+byte EtherEventQueueClass::etherEventEventLengthMax = 0;
+unsigned int EtherEventQueueClass::etherEventPayloadLengthMax = 0;
+
+
+EtherEventQueueClass::EtherEventQueueClass() {  //everything is initialized here so that instances other than the global EtherEventQueue(e.g. local or dynamically allocated) are safe to use
   nodeTimeoutDuration = nodeTimeoutDurationDefault;
   sendKeepaliveMargin = sendKeepaliveMarginDefault;
+  sendKeepaliveNode = 0;
+  workBudgetItems = 0;
+  workBudgetTime = 0;
   sendKeepaliveResendDelay = sendKeepaliveResendDelayDefault;
   resendDelay = resendDelayDefault;
   queueDoubleDecimalPlaces = queueDoubleDecimalPlacesDefault;
+  compressionLengthMax = 0;
+
+  nodeDevice = 0;
+  defaultPort = 0;
+  receivedEventLengthMax = 0;
+  receivedEventIDvalue = 0;
+  receivedEvent = NULL;
+  receivedPayloadLengthMax = 0;
+  receivedPayload = NULL;
+  receivedEventLength = 0;
+  receivedPayloadCompact = false;
+  receiveNodesOnlyState = false;
+
+  queueSizeMax = 0;
+  queueIndex = NULL;
+  IPqueue = NULL;
+  portQueue = NULL;
+  sendEventLengthMax = 0;
+  eventQueue = NULL;
+  eventIDqueue = NULL;
+  sendPayloadLengthMax = 0;
+  payloadQueue = NULL;
+  memset(&eventBufferPool, 0, sizeof(eventBufferPool));
+  memset(&payloadBufferPool, 0, sizeof(payloadBufferPool));
+  eventTypeQueue = NULL;
+  queueTimestamp = NULL;
+  flagsQueue = NULL;
+  queueNewCount = 0;
+  internalEventQueueCount = 0;
+  queueSize = 0;
+  queuePriorityLevel = 0;
+  queueHandlerScanRemaining = 0;
+  internalEventStep = -1;
+  queueSendTimestamp = 0;
+  queueOverflowFlag = false;
+  sendNodesOnlyState = false;
+
+  nodeCount = 0;
+  nodeIP = NULL;
+  nodeIndex = NULL;
+  nodeIndexCount = 0;
+  nodeRange = NULL;
+  nodeRangeCount = 0;
+  nodeState = NULL;
+  nodeTimestamp = NULL;
+  sendKeepaliveTimestamp = NULL;
+  nodeGapMean = NULL;
+  nodeGapDeviation = NULL;
+  nodeTimeoutDeviationFactor = 0;
+  nodeTimeoutMin = 0;
+  nodeTimeoutMax = 0;
+
+  eventKeepalive = NULL;
+  eventKeepaliveFlash = false;
+  eventAck = NULL;
+  eventAckFlash = false;
+  ackPiggyback = false;
+  eventIDlast = 99;  //the first eventID is 10
+  nodeEventIDlast = NULL;
+  duplicateWindow = NULL;
+  duplicateTimestamp = NULL;
+  duplicateWindowDuration = 0;
+  duplicateAckPort = 0;
+  nodeWindow = NULL;
+  sendWindowSize = 0;
+  sendWindowAdaptive = false;
+  sendWindowBlockedCount = 0;
+  circuitBreaker = NULL;
+  circuitBreakerCount = 0;
+  circuitFailureThreshold = 0;
+  circuitOpenDuration = 0;
+  nodeRateLimit = NULL;
+  memset(&defaultRateLimit, 0, sizeof(defaultRateLimit));
+  rateLimitDeferredCount = 0;
+  rateLimitRetryTimestamp = 0;
+  clockFunction = NULL;
+  network = NULL;
+
+  memset(&stats, 0, sizeof(stats));
+  nodeStats = NULL;
+  sendStatsTimestamp = 0;
+  latencyHistogram = NULL;
+  multicastMask = NULL;
+  multicastEventID = NULL;
+  stagingQueue = NULL;
+  stagingQueueLength = 0;
+  stagingStrings = NULL;
+  stagingStringLengthMax = 0;
+  stagingHead = 0;
+  stagingTail = 0;
+  receiveBuffer = NULL;
+  receiveBufferSize = 0;
+  receiveBufferHead = 0;
+  receiveBufferUsed = 0;
+  receiveBufferCount = 0;
+  receivePollCount = 1;
+
+  storage = NULL;
+  storageRecordLength = 0;
+  storageRecordCount = 0;
+  storageHead = 0;
+  storageTail = 0;
+  storageUsed = 0;
+  storageReplayRecord = 0;
+  storageCount = 0;
+  storageRecordQueue = NULL;
+  storageSequence = 0;
+  storageReplaying = false;
 }
 
 
@@ -42,12 +160,12 @@ boolean EtherEventQueueClass::begin(const byte queueSizeMaxInput, const byte sen
 }
 
 
-boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, const byte nodeCountInput) {  //default buffer length version - the deviceNode is 0
+boolean EtherEventQueueClass::begin(const unsigned int nodeDeviceInput, const unsigned int nodeCountInput) {  //default buffer length version - the deviceNode is 0
   return begin(nodeDeviceInput, nodeCountInput, queueSizeMaxDefault, eventLengthMaxDefault, payloadLengthMaxDefault, eventLengthMaxDefault, payloadLengthMaxDefault);
 }
 
 
-boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountInput, byte queueSizeMaxInput, const byte sendEventLengthMaxInput, const unsigned int sendPayloadLengthMaxInput, const byte receivedEventLengthMaxInput, const unsigned int receivedPayloadLengthMaxInput) {
+boolean EtherEventQueueClass::begin(const unsigned int nodeDeviceInput, unsigned int nodeCountInput, byte queueSizeMaxInput, const byte sendEventLengthMaxInput, const unsigned int sendPayloadLengthMaxInput, const byte receivedEventLengthMaxInput, const unsigned int receivedPayloadLengthMaxInput) {
 #if ETHEREVENTQUEUE_DEBUG == true
   delay(20);  //There needs to be a delay between the calls to Serial.begin() in sketch setup() and here or garbage will be printed to the serial monitor
 #endif
@@ -56,22 +174,81 @@ boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountIn
 
   nodeDevice = nodeDeviceInput;
   nodeCountInput = max(nodeDevice + 1, nodeCountInput);  //the nodeCount has to be enough to hold the device node number
-  for (byte counter = 0; counter < nodeCount; counter++) {  //free previously allocated array items - this has to be done for arrays only because realloc doesn't work with the array items
-    free(nodeIP[counter]);
-  }
-  nodeIP = (byte**)realloc(nodeIP, nodeCountInput * sizeof(byte*));  //have to use 4 byte arrays for the IP addresses instead of IPAddress because I can't get IPAddress to work with malloc
-  for (byte nodeCounter = 0; nodeCounter < nodeCountInput; nodeCounter++) {
-    nodeIP[nodeCounter] = (byte*)malloc(4 * sizeof(byte));  //4 bytes/IP address
-    //zero initialize the IP Address - this will indicate that the node has not yet been configured
-    for (byte counter = 0; counter < 4; counter++) {
-      nodeIP[nodeCounter][counter] = 0;
-    }
+  nodeIP = (byte(*)[4])realloc(nodeIP, nodeCountInput * sizeof(nodeIP[0]));  //one allocation for all nodes instead of one per node to save the malloc overhead
+  if (nodeIP != NULL) {
+    memset(nodeIP, 0, nodeCountInput * sizeof(nodeIP[0]));  //zero initialize the IP Addresses - this will indicate that the nodes have not yet been configured
   }
+  nodeIndex = (unsigned int*)realloc(nodeIndex, nodeCountInput * sizeof(unsigned int));
+  nodeIndexCount = 0;
+  free(nodeRange);
+  nodeRange = NULL;
+  nodeRangeCount = 0;
 
   nodeState = (byte*)realloc(nodeState, nodeCountInput * sizeof(byte));
+  nodeEventIDlast = (byte*)realloc(nodeEventIDlast, nodeCountInput * sizeof(byte));
+  if (nodeEventIDlast != NULL) {
+    memset(nodeEventIDlast, 99, nodeCountInput * sizeof(byte));  //the first eventID to each node is 10
+  }
   nodeTimestamp = (unsigned long*)realloc(nodeTimestamp, nodeCountInput * sizeof(unsigned long));
   sendKeepaliveTimestamp = (unsigned long*)realloc(sendKeepaliveTimestamp, nodeCountInput * sizeof(unsigned long));
-  nodeCount = max(nodeDevice + 1, nodeCountInput);  //set this after the buffers have been realloced so that the old value can be used for free()ing the array items
+  if (nodeStats != NULL) {  //node statistics are enabled
+    nodeStats = (nodeStats_t*)realloc(nodeStats, nodeCountInput * sizeof(nodeStats_t));
+    if (nodeStats == NULL) {
+      Serial.println(F("memory allocation failed"));
+    }
+  }
+  if (nodeGapMean != NULL) {  //adaptive node timeout is enabled
+    nodeGapMean = (unsigned long*)realloc(nodeGapMean, nodeCountInput * sizeof(unsigned long));
+    nodeGapDeviation = (unsigned long*)realloc(nodeGapDeviation, nodeCountInput * sizeof(unsigned long));
+    if (nodeGapMean == NULL || nodeGapDeviation == NULL) {
+      Serial.println(F("memory allocation failed"));
+      free(nodeGapMean);
+      free(nodeGapDeviation);
+      nodeGapMean = NULL;
+      nodeGapDeviation = NULL;
+    }
+    else {
+      memset(nodeGapMean, 0, nodeCountInput * sizeof(unsigned long));  //no measurements
+      memset(nodeGapDeviation, 0, nodeCountInput * sizeof(unsigned long));
+    }
+  }
+  if (duplicateWindow != NULL) {  //duplicate suppression is enabled
+    duplicateWindow = (byte*)realloc(duplicateWindow, nodeCountInput * ackBitsLength);
+    duplicateTimestamp = (unsigned long*)realloc(duplicateTimestamp, nodeCountInput * sizeof(unsigned long));
+    if (duplicateWindow == NULL || duplicateTimestamp == NULL) {
+      Serial.println(F("memory allocation failed"));
+      free(duplicateWindow);
+      free(duplicateTimestamp);
+      duplicateWindow = NULL;
+      duplicateTimestamp = NULL;
+    }
+    else {
+      memset(duplicateWindow, 0, nodeCountInput * ackBitsLength);  //no received eventIDs
+    }
+  }
+  if (nodeWindow != NULL) {  //send window is enabled
+    nodeWindow = (nodeWindow_t*)realloc(nodeWindow, nodeCountInput * sizeof(nodeWindow_t));
+    if (nodeWindow == NULL) {
+      Serial.println(F("memory allocation failed"));
+      sendWindowSize = 0;
+    }
+  }
+  if (nodeRateLimit != NULL) {  //rate limits are enabled
+    nodeRateLimit = (rateLimit_t*)realloc(nodeRateLimit, nodeCountInput * sizeof(rateLimit_t));
+    if (nodeRateLimit == NULL) {
+      Serial.println(F("memory allocation failed"));
+    }
+    else if (nodeCountInput > nodeCount) {
+      memset(nodeRateLimit + nodeCount, 0, (nodeCountInput - nodeCount) * sizeof(rateLimit_t));  //the added nodes are not rate limited
+    }
+  }
+  nodeCount = nodeCountInput;
+  sendWindowReset();
+  if (nodeIP == NULL || nodeIndex == NULL || nodeState == NULL || nodeEventIDlast == NULL || nodeTimestamp == NULL || sendKeepaliveTimestamp == NULL) {
+    Serial.println(F("memory allocation failed"));
+    nodeCount = 0;
+    return false;
+  }
 
   setNode(nodeDeviceInput, Ethernet.localIP());  //configure the device node
 
@@ -83,6 +260,14 @@ boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountIn
   for (byte counter = 0; counter < queueSizeMaxInput; counter++) {
     queueIndex[counter] = -1;  //set all queueIndex priority levels empty
   }
+  queueSize = 0;
+  queueNewCount = 0;
+  internalEventQueueCount = 0;
+  queuePriorityLevel = 0;
+  queueHandlerScanRemaining = 0;
+  internalEventStep = -1;
+  sendKeepaliveNode = 0;
+  rateLimitDeferredCount = 0;
 
   for (byte counter = 0; counter < queueSizeMax; counter++) {  //free previously allocated array items - this has to be done for arrays only because realloc doesn't work with the array items
     free(IPqueue[counter]);
@@ -94,27 +279,29 @@ boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountIn
 
   portQueue = (unsigned int*)realloc(portQueue, queueSizeMaxInput * sizeof(unsigned int));
 
-  for (byte counter = 0; counter < queueSizeMax; counter++) {
-    free(eventQueue[counter]);
-  }
   eventQueue = (char**)realloc(eventQueue, queueSizeMaxInput * sizeof(char*));
   sendEventLengthMax = sendEventLengthMaxInput;
   for (byte counter = 0; counter < queueSizeMaxInput; counter++) {
-    eventQueue[counter] = (char*)malloc((sendEventLengthMax + 1) * sizeof(char));
+    eventQueue[counter] = NULL;  //the queue slots take a buffer from the eventBufferPool when an event is queued
   }
+  const boolean eventBufferPoolAllocated = queueBufferPoolBegin(eventBufferPool, queueSizeMaxInput, sendEventLengthMax);
 
   eventIDqueue = (byte*)realloc(eventIDqueue, queueSizeMaxInput * sizeof(byte));
 
-  for (byte counter = 0; counter < queueSizeMax; counter++) {
-    free(payloadQueue[counter]);
-  }
   payloadQueue = (char**)realloc(payloadQueue, queueSizeMaxInput * sizeof(char*));
   sendPayloadLengthMax = sendPayloadLengthMaxInput;
   for (byte counter = 0; counter < queueSizeMaxInput; counter++) {
-    payloadQueue[counter] = (char*)malloc((sendPayloadLengthMax + 1) * sizeof(char));
+    payloadQueue[counter] = NULL;
   }
+  const boolean payloadBufferPoolAllocated = queueBufferPoolBegin(payloadBufferPool, queueSizeMaxInput, sendPayloadLengthMax);
 
   eventTypeQueue = (byte*)realloc(eventTypeQueue, queueSizeMaxInput * sizeof(byte));
+  queueTimestamp = (unsigned long*)realloc(queueTimestamp, queueSizeMaxInput * sizeof(unsigned long));
+  flagsQueue = (byte*)realloc(flagsQueue, queueSizeMaxInput * sizeof(byte));
+  free(multicastMask);  //allocated for the new queueSizeMax and nodeCount by the next queueMulticast()
+  multicastMask = NULL;
+  free(multicastEventID);
+  multicastEventID = NULL;
 
   queueSizeMax = queueSizeMaxInput;  //save the new queueSizeMax, this is done at the end of begin() because it needs to remember the previous value for freeing the array items
 
@@ -125,10 +312,33 @@ boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountIn
   receivedPayloadLengthMax = receivedPayloadLengthMaxInput;
   receivedPayload = (char*)realloc(receivedPayload, (receivedPayloadLengthMax + 1) * sizeof(char));
   receivedPayload[0] = 0;  //clear buffer - realloc does not zero initialize so the buffer could contain anything
-  if (IPqueue == NULL || portQueue == NULL || eventQueue == NULL || eventIDqueue == NULL || payloadQueue == NULL || eventTypeQueue == NULL || receivedEvent == NULL || receivedPayload == NULL || EtherEvent.begin(receivedEventLengthMax, eventIDlength + receivedPayloadLengthMax) == false) {
+  receiveBufferHead = 0;  //the buffered events were received with the previous buffer lengths
+  receiveBufferUsed = 0;
+  receiveBufferCount = 0;
+  if (receiveBuffer != NULL && receiveBufferSize < receiveBufferRecordLengthMax()) {  //the receive buffer can't hold an event of the new lengths
+    Serial.println(F("EtherEventQueue.begin: receive buffer disabled"));
+    setReceiveBuffer(0);
+  }
+  resetStats();  //this also initializes the nodeStats buffer if node statistics are enabled
+
+  etherEventEventLengthMax = max(etherEventEventLengthMax, receivedEventLengthMax);
+  etherEventPayloadLengthMax = max(etherEventPayloadLengthMax, eventIDlength + receivedPayloadLengthMax);
+
+  if (IPqueue == NULL || portQueue == NULL || eventQueue == NULL || eventIDqueue == NULL || payloadQueue == NULL || !eventBufferPoolAllocated || !payloadBufferPoolAllocated || eventTypeQueue == NULL || queueTimestamp == NULL || flagsQueue == NULL || receivedEvent == NULL || receivedPayload == NULL || EtherEvent.begin(etherEventEventLengthMax, etherEventPayloadLengthMax) == false) {
     Serial.println(F("memory allocation failed"));
     return false;
   }
+  if (storage != NULL) {
+    storageRecordQueue = (unsigned int*)realloc(storageRecordQueue, queueSizeMax * sizeof(unsigned int));
+    if (storageRecordQueue == NULL) {
+      Serial.println(F("memory allocation failed"));
+      return false;
+    }
+    for (byte counter = 0; counter < queueSizeMax; counter++) {
+      storageRecordQueue[counter] = storageRecordNone;
+    }
+    storageBegin();  //find the events stored before the reset, they are replayed by queueHandler()
+  }
   return true;
 }
 
@@ -137,6 +347,10 @@ boolean EtherEventQueueClass::begin(const byte nodeDeviceInput, byte nodeCountIn
 //availablePayload - returns the number of chars in the payload including the null terminator if there is one
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 unsigned int EtherEventQueueClass::availablePayload() {
+  if (receivedPayloadCompact) {  //the string version of the compact payload is only created when it's needed
+    receivedPayloadCompact = false;
+    receivedPayloadValueData.write(receivedPayload, receivedPayloadLengthMax, queueDoubleDecimalPlaces);
+  }
   Serial.print(F("EtherEventQueue.availablePayload: length="));
   if (const unsigned int length = strlen(receivedPayload)) {  //strlen(receivedPayload)>0
     Serial.println(length + 1);
@@ -162,6 +376,7 @@ void EtherEventQueueClass::readEvent(char eventBuffer[]) {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void EtherEventQueueClass::readPayload(char payloadBuffer[]) {
   Serial.println(F("EtherEventQueue.readPayload"));
+  availablePayload();  //convert compact payloads
   strcpy(payloadBuffer, receivedPayload);
 }
 
@@ -174,6 +389,14 @@ byte EtherEventQueueClass::receivedEventID() {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receivedPayloadValue - returns the typed value of a compact encoded received payload. For text payloads the type is value_t::typeString.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const EtherEventQueueClass::value_t& EtherEventQueueClass::receivedPayloadValue() {
+  return receivedPayloadValueData;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //flushReceiver - dump the last message received so another one can be received
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -181,38 +404,87 @@ void EtherEventQueueClass::flushReceiver() {
   Serial.println(F("EtherEventQueue.flushReceiver"));
   receivedEvent[0] = 0;  //reset the event buffer
   receivedPayload[0] = 0;  //reset the payload buffer
+  receivedPayloadCompact = false;
+  receivedPayloadValueData = value_t();
   receivedEventLength = 0;  //enable availableEvent() to receive new events
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setReceiveBuffer - buffer up to bufferSize bytes of received events so availableEvent() accepts new events while the sketch has not read the last one yet. The events are passed to the sketch in the order they were received.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setReceiveBuffer(const unsigned int bufferSize) {
+  Serial.print(F("EtherEventQueue.setReceiveBuffer: bufferSize="));
+  Serial.println(bufferSize);
+  free(receiveBuffer);  //any buffered events are discarded
+  receiveBuffer = NULL;
+  receiveBufferSize = 0;
+  receiveBufferHead = 0;
+  receiveBufferUsed = 0;
+  receiveBufferCount = 0;
+  if (bufferSize == 0) {  //disable
+    return true;
+  }
+  if (bufferSize < receiveBufferRecordLengthMax()) {
+    Serial.println(F("EtherEventQueue.setReceiveBuffer: bufferSize too small for the received event buffer lengths"));
+    return false;
+  }
+  receiveBuffer = (byte*)malloc(bufferSize);
+  if (receiveBuffer == NULL) {
+    Serial.println(F("EtherEventQueue.setReceiveBuffer: memory allocation failed"));
+    return false;
+  }
+  receiveBufferSize = bufferSize;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getReceiveBufferCount - returns the number of received events waiting in the receive buffer, not including the event returned by availableEvent()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::getReceiveBufferCount() {
+  return receiveBufferCount;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setReceivePoll - service up to connectionCount pending connections in each availableEvent() call so concurrent senders don't have to wait for the following calls
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setReceivePoll(const byte connectionCount) {
+  Serial.print(F("EtherEventQueue.setReceivePoll: connectionCount="));
+  Serial.println(connectionCount);
+  receivePollCount = max(connectionCount, (byte)1);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //queue - add the relayed outgoing message to the send queue. Returns: 0==fail, 1==success, 2==success w/ queue overflow
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
 //convert IPAddress to 4 byte array
-byte EtherEventQueueClass::queue(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const char event[], const char payload[]) {
+byte EtherEventQueueClass::queue(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
   Serial.print(F("EtherEventQueue.queue(convert IPAddress): targetIPAddress="));
   Serial.println(targetIPAddress);
   byte targetIP[4];  //create buffer
   IPcopy(targetIP, targetIPAddress);  //convert
-  return queue((const byte*)targetIP, port, eventType, (const char*)event, payload);
+  return queue((const byte*)targetIP, port, eventType, event, payload);
 }
 
 
 //convert node to 4 byte array
-byte EtherEventQueueClass::queue(const byte targetNode, const unsigned int port, const byte eventType, const char event[], const char payload[]) {
+byte EtherEventQueueClass::queue(const unsigned int targetNode, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
   Serial.println(F("EtherEventQueue.queue(convert node)"));
   if (targetNode >= nodeCount || !nodeIsSet(targetNode)) {  //sanity check
     Serial.println(F("EtherEventQueue.queue(convert node): invalid node number"));
     return false;
   }
-  return queue((const byte*)nodeIP[targetNode], port, eventType, (const char*)event, payload);
+  return queue((const byte*)nodeIP[targetNode], port, eventType, event, payload);
 }
 
 
 //main queue() function
-byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port, const byte eventType, const char event[], const char payload[]) {
+byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
   Serial.println(F("EtherEventQueue.queue(main)"));
   if ((eventType != eventTypeOnce && eventType != eventTypeRepeat && eventType != eventTypeConfirm && eventType != eventTypeOverrideTimeout) || (eventType == eventTypeConfirm && eventAck == NULL)) { //eventType sanity check
     Serial.println(F("EtherEventQueue.queue: invalid eventType"));
@@ -226,15 +498,23 @@ byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port,
     }
   }
   //target is a node
-  else  if (targetNode == nodeDevice) {  //send events to self regardless of timeout state
+  else  if ((unsigned int)targetNode == nodeDevice) {  //send events to self regardless of timeout state
     Serial.println(F("EtherEventQueue.queue: self send"));
     internalEventQueueCount++;
   }
-  else if (millis() - nodeTimestamp[targetNode] > nodeTimeoutDuration && eventType != eventTypeOverrideTimeout) {  //is a node, not self, is timed out, and is not eventTypeOverrideTimeout
+  else if (clockMillis() - nodeTimestamp[targetNode] > nodeTimeout(targetNode) && eventType != eventTypeOverrideTimeout) {  //is a node, not self, is timed out, and is not eventTypeOverrideTimeout
     Serial.println(F("EtherEventQueue.queue: timed out node"));
     return false;  //don't queue events to timed out nodes
   }
 
+  if (storage != NULL && !storageReplaying && (targetNode < 0 || (unsigned int)targetNode != nodeDevice) && (queueSize == queueSizeMax || storageCount > 0)) {  //the queue is full or older events are already stored so the event has to be stored to keep the order
+    if (storageAppend(targetIP, port, eventType, event, payload)) {
+      Serial.println(F("EtherEventQueue.queue: stored"));
+      stats.spilled++;
+      return true;
+    }
+  }
+
   byte success = true;  //set default success value to indicate event successfully queued in return
 
   Serial.print(F("EtherEventQueue.queue: queueSize="));
@@ -243,10 +523,14 @@ byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port,
   byte queueSlot;
   if (queueSize == queueSizeMax) {  //queue overflowed
     Serial.println(F("EtherEventQueue.queue: Queue Overflowed"));
-    queueSlot = queueIndex[queueSize - 1];
-    remove(queueSlot);
+    const int8_t overflowSlot = overflowRemove();
+    if (overflowSlot < 0) {
+      return false;
+    }
+    queueSlot = overflowSlot;
     success = queueSuccessOverflow;  //indicate overflow in the return
     queueOverflowFlag = true;  //set the overflow flag for use in checkQueueOverflow()
+    stats.overflowed++;
   }
   else {  //there are empty queue slots
     //find an empty queue slot
@@ -264,38 +548,253 @@ byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port,
       }
     }
   }
+  while (queueSize > 0 && !queueBuffersAvailable(event, payload)) {  //all the buffers set by setQueueBuffers() are in use, the newest events are overflowed the same as when the queue is full
+    Serial.println(F("EtherEventQueue.queue: Queue Buffers Overflowed"));
+    if (overflowRemove() < 0) {
+      return false;
+    }
+    success = queueSuccessOverflow;
+    queueOverflowFlag = true;
+    stats.overflowed++;
+  }
+
+  const byte eventID = eventIDfind(targetNode);  //the new slot isn't in the queueIndex yet so its previous eventID is not counted as being used
+  queueSlotWrite(queueSlot, targetIP, targetNode >= 0 && (unsigned int)targetNode == nodeDevice, port, eventType, event, payload, eventID);
+  return success;
+}
+
+
+//batch queue() - the node lookup and the timeout check are done once for consecutive records to the same target, the free queue slots and eventIDs are found in a single pass and the queue overflow is handled once for the whole batch. The result of each record is written to results. Returns the number of records queued.
+byte EtherEventQueueClass::queue(const queueRecord_t records[], const byte recordCount, byte results[]) {
+  Serial.print(F("EtherEventQueue.queue(batch): recordCount="));
+  Serial.println(recordCount);
+  byte queuedCount = 0;
+  if (storage != NULL || eventBufferPool.count < queueSizeMax || payloadBufferPool.count < queueSizeMax) {  //the persistent storage decides for each event whether it has to be stored to keep the order and the buffers set by setQueueBuffers() are checked for each event
+    for (byte recordNumber = 0; recordNumber < recordCount; recordNumber++) {
+      const queueRecord_t &record = records[recordNumber];
+      if (record.targetNode >= 0) {
+        results[recordNumber] = queue((unsigned int)record.targetNode, record.port, record.eventType, record.event, record.payload);
+      }
+      else {
+        results[recordNumber] = queue(record.targetIP, record.port, record.eventType, record.event, record.payload);
+      }
+      if (results[recordNumber] != false) {
+        queuedCount++;
+      }
+    }
+    return queuedCount;
+  }
+
+  //check the records, results is set to true for the records that will be queued
+  const byte* targetIPprevious = NULL;
+  int targetNodePrevious = -1;
+  boolean timedOutPrevious = false;
+  byte acceptedCount = 0;
+  byte acceptedCountMax = queueSizeMax;
+  for (byte position = 0; position < queueSize; position++) {
+    if (flagsQueue[queueIndex[position]] & queueFlagMulticast) {  //multicast events are not overflowed so their slots can't be used by the batch
+      acceptedCountMax--;
+    }
+  }
+  for (byte recordNumber = 0; recordNumber < recordCount; recordNumber++) {
+    const queueRecord_t &record = records[recordNumber];
+    results[recordNumber] = false;
+    if ((record.eventType != eventTypeOnce && record.eventType != eventTypeRepeat && record.eventType != eventTypeConfirm && record.eventType != eventTypeOverrideTimeout) || (record.eventType == eventTypeConfirm && eventAck == NULL)) { //eventType sanity check
+      Serial.println(F("EtherEventQueue.queue(batch): invalid eventType"));
+      continue;
+    }
+    const byte* targetIP = record.targetIP;
+    if (record.targetNode >= 0) {
+      if ((unsigned int)record.targetNode >= nodeCount || !nodeIsSet(record.targetNode)) {
+        Serial.println(F("EtherEventQueue.queue(batch): invalid node number"));
+        continue;
+      }
+      targetIP = nodeIP[record.targetNode];
+    }
+    if (targetIPprevious == NULL || targetIP[0] != targetIPprevious[0] || targetIP[1] != targetIPprevious[1] || targetIP[2] != targetIPprevious[2] || targetIP[3] != targetIPprevious[3]) {  //not the same target as the previous record
+      targetIPprevious = targetIP;
+      targetNodePrevious = record.targetNode >= 0 ? record.targetNode : getNode(targetIP);
+      timedOutPrevious = targetNodePrevious >= 0 && (unsigned int)targetNodePrevious != nodeDevice && clockMillis() - nodeTimestamp[targetNodePrevious] > nodeTimeout(targetNodePrevious);
+    }
+    if (targetNodePrevious < 0 && sendNodesOnlyState == 1) {
+      Serial.println(F("EtherEventQueue.queue(batch): not a node"));
+      continue;
+    }
+    if (timedOutPrevious && record.eventType != eventTypeOverrideTimeout) {
+      Serial.println(F("EtherEventQueue.queue(batch): timed out node"));
+      continue;
+    }
+    if (acceptedCount == acceptedCountMax) {  //the records that don't fit in the empty queue are not queued
+      Serial.println(F("EtherEventQueue.queue(batch): batch larger than the queue"));
+      continue;
+    }
+    results[recordNumber] = true;
+    acceptedCount++;
+  }
+
+  //make room for the batch by removing the newest events, the same as the overflow of a single event
+  byte overflowCount = 0;
+  if (queueSize + acceptedCount > queueSizeMax) {
+    Serial.println(F("EtherEventQueue.queue(batch): Queue Overflowed"));
+    overflowCount = queueSize + acceptedCount - queueSizeMax;
+    for (byte counter = 0; counter < overflowCount; counter++) {
+      overflowRemove();  //acceptedCount is limited so there are enough events that are not multicast events
+    }
+    queueOverflowFlag = true;  //set the overflow flag for use in checkQueueOverflow()
+    stats.overflowed += overflowCount;
+  }
+
+  //find the empty queue slots and the free eventIDs once for the whole batch
+  byte queueSlotsUsed[(queueSizeMax + 7) / 8];
+  memset(queueSlotsUsed, 0, sizeof(queueSlotsUsed));
+  for (byte position = 0; position < queueSize; position++) {
+    queueSlotsUsed[queueIndex[position] >> 3] |= 1 << (queueIndex[position] & 7);
+  }
+  byte eventIDsUsed[ackBitsLength];
+  eventIDsUsedFind(eventIDsUsed);
+
+  byte queueSlot = 0;
+  targetIPprevious = NULL;
+  for (byte recordNumber = 0; recordNumber < recordCount; recordNumber++) {
+    if (results[recordNumber] == false) {
+      continue;
+    }
+    const queueRecord_t &record = records[recordNumber];
+    while (queueSlotsUsed[queueSlot >> 3] & (1 << (queueSlot & 7))) {
+      queueSlot++;
+    }
+    queueSlotsUsed[queueSlot >> 3] |= 1 << (queueSlot & 7);
+    const byte* targetIP = record.targetNode >= 0 ? nodeIP[record.targetNode] : record.targetIP;
+    if (targetIPprevious == NULL || targetIP[0] != targetIPprevious[0] || targetIP[1] != targetIPprevious[1] || targetIP[2] != targetIPprevious[2] || targetIP[3] != targetIPprevious[3]) {  //the node is needed for its eventID rotation
+      targetIPprevious = targetIP;
+      targetNodePrevious = record.targetNode >= 0 ? record.targetNode : getNode(targetIP);
+    }
+    const boolean internalEvent = targetIP[0] == nodeIP[nodeDevice][0] && targetIP[1] == nodeIP[nodeDevice][1] && targetIP[2] == nodeIP[nodeDevice][2] && targetIP[3] == nodeIP[nodeDevice][3];
+    if (internalEvent) {
+      internalEventQueueCount++;
+    }
+    queueSlotWrite(queueSlot, targetIP, internalEvent, record.port, record.eventType, record.event, record.payload, eventIDnext(eventIDsUsed, targetNodePrevious));
+    queuedCount++;
+    if (queuedCount > acceptedCount - overflowCount) {  //the last overflowCount records took the places of the removed events
+      results[recordNumber] = queueSuccessOverflow;
+    }
+  }
+  return queuedCount;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueBufferPoolBegin - allocate the buffers of the pool for the queue size and buffer length set by begin(). All buffers are unused after this. Returns false on memory allocation failure.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::queueBufferPoolBegin(queueBufferPool_t &pool, const byte queueSizeMaxInput, const unsigned int lengthMax) {
+  pool.count = pool.countSetting == 0 || pool.countSetting > queueSizeMaxInput ? queueSizeMaxInput : pool.countSetting;  //there is never a use for more buffers than queue slots
+  pool.buffers = (char*)realloc(pool.buffers, pool.count * (lengthMax + 1) * sizeof(char));
+  pool.freeIndex = (byte*)realloc(pool.freeIndex, pool.count * sizeof(byte));
+  if (pool.buffers == NULL || pool.freeIndex == NULL) {
+    pool.freeCount = 0;
+    return false;
+  }
+  for (pool.freeCount = 0; pool.freeCount < pool.count; pool.freeCount++) {
+    pool.freeIndex[pool.freeCount] = pool.freeCount;
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueBuffersAvailable - returns true if there are the buffers needed to queue the event and payload. F() strings that are stored by reference don't need one.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::queueBuffersAvailable(const value_t &event, const value_t &payload) {
+  return (eventBufferPool.freeCount > 0 || flashReferenceFits(sendEventLengthMax, event)) && (payloadBufferPool.freeCount > 0 || flashReferenceFits(sendPayloadLengthMax, payload));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueBufferTake - returns an unused buffer of the pool. queueBuffersAvailable() must be checked first.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+char* EtherEventQueueClass::queueBufferTake(queueBufferPool_t &pool, const unsigned int lengthMax) {
+  pool.freeCount--;
+  return pool.buffers + pool.freeIndex[pool.freeCount] * (lengthMax + 1);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueBufferRelease - return the buffer taken by queueBufferTake() to the pool
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::queueBufferRelease(queueBufferPool_t &pool, const char buffer[], const unsigned int lengthMax) {
+  pool.freeIndex[pool.freeCount] = (buffer - pool.buffers) / (lengthMax + 1);
+  pool.freeCount++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueSlotBuffersRelease - return the event and payload buffers of the queue slot to the pools
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::queueSlotBuffersRelease(const byte queueSlot) {
+  if (eventQueue[queueSlot] != NULL && !(flagsQueue[queueSlot] & queueFlagEventFlash)) {  //the slot is NULL after it has been released so a buffer is never returned twice
+    queueBufferRelease(eventBufferPool, eventQueue[queueSlot], sendEventLengthMax);
+  }
+  eventQueue[queueSlot] = NULL;
+  if (payloadQueue[queueSlot] != NULL && !(flagsQueue[queueSlot] & queueFlagPayloadFlash)) {
+    queueBufferRelease(payloadBufferPool, payloadQueue[queueSlot], sendPayloadLengthMax);
+  }
+  payloadQueue[queueSlot] = NULL;
+}
 
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueSlotWrite - write the event to the empty queueSlot and add it to the end of the queueIndex
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::queueSlotWrite(const byte queueSlot, const byte targetIP[], const boolean internalEvent, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload, const byte eventID) {
   //add the new message to the queue
   queueSize++;
   queueIndex[queueSize - 1] = queueSlot;
   IPcopy(IPqueue[queueSlot], targetIP);
   portQueue[queueSlot] = port;
-  strncpy(eventQueue[queueSlot], event, sendEventLengthMax);
-  eventQueue[queueSlot][sendEventLengthMax] = 0;  //add null terminator in case event is longer than sendPayloadLengthMax
-  eventIDqueue[queueSlot] = eventIDfind();
-  strncpy(payloadQueue[queueSlot], payload, sendPayloadLengthMax);
-  payloadQueue[queueSlot][sendPayloadLengthMax] = 0;  //add null terminator in case payload is longer than sendPayloadLengthMax
+  flagsQueue[queueSlot] = 0;
+  if (flashReferenceStore(eventQueue[queueSlot], sendEventLengthMax, event)) {  //F() events are stored by reference
+    flagsQueue[queueSlot] |= queueFlagEventFlash;
+  }
+  else {
+    eventQueue[queueSlot] = queueBufferTake(eventBufferPool, sendEventLengthMax);
+    event.write(eventQueue[queueSlot], sendEventLengthMax, queueDoubleDecimalPlaces);  //convert the event directly into the queue slot, longer events are truncated
+  }
+  eventIDqueue[queueSlot] = eventID;
+  if (flashReferenceStore(payloadQueue[queueSlot], sendPayloadLengthMax, payload)) {
+    flagsQueue[queueSlot] |= queueFlagPayloadFlash;
+  }
+  else {
+    payloadQueue[queueSlot] = queueBufferTake(payloadBufferPool, sendPayloadLengthMax);
+    if (payload.writeCompact(payloadQueue[queueSlot], sendPayloadLengthMax) == 0 && (internalEvent || !payloadCompress(payloadQueue[queueSlot], payload))) {  //not a compact payload and not compressed, internal events are never compressed
+      payload.write(payloadQueue[queueSlot], sendPayloadLengthMax, queueDoubleDecimalPlaces);  //convert the payload directly into the queue slot, longer payloads are truncated
+    }
+  }
   eventTypeQueue[queueSlot] = eventType;
+  queueTimestamp[queueSlot] = clockMillis();
 
   queueNewCount++;
 
-  Serial.print(F("EtherEventQueue.queue: done, queueSlot="));
+  stats.enqueued++;
+  if (queueSize > stats.queueSizeHighWater) {
+    stats.queueSizeHighWater = queueSize;
+  }
+
+  Serial.print(F("EtherEventQueue.queueSlotWrite: done, queueSlot="));
   Serial.println(queueSlot);
-  Serial.print(F("EtherEventQueue.queue: queueNewCount="));
+  Serial.print(F("EtherEventQueue.queueSlotWrite: queueNewCount="));
   Serial.println(queueNewCount);
-  Serial.print(F("EtherEventQueue.queue: IP="));
+  Serial.print(F("EtherEventQueue.queueSlotWrite: IP="));
   Serial.println(IPAddress(IPqueue[queueSlot]));
-  Serial.print(F("EtherEventQueue.queue: port="));
+  Serial.print(F("EtherEventQueue.queueSlotWrite: port="));
   Serial.println(portQueue[queueSlot]);
-  Serial.print(F("EtherEventQueue.queue: event="));
-  Serial.println(eventQueue[queueSlot]);
-  Serial.print(F("EtherEventQueue.queue: payload="));
-  Serial.println(payloadQueue[queueSlot]);
-  Serial.print(F("EtherEventQueue.queue: eventID="));
+  Serial.print(F("EtherEventQueue.queueSlotWrite: event flash="));
+  Serial.println(flagsQueue[queueSlot] & queueFlagEventFlash);
+  Serial.print(F("EtherEventQueue.queueSlotWrite: payload flash="));
+  Serial.println(flagsQueue[queueSlot] & queueFlagPayloadFlash);
+  Serial.print(F("EtherEventQueue.queueSlotWrite: eventID="));
   Serial.println(eventIDqueue[queueSlot]);
-  Serial.print(F("EtherEventQueue.queue: eventType="));
+  Serial.print(F("EtherEventQueue.queueSlotWrite: eventType="));
   Serial.println(eventTypeQueue[queueSlot]);
-  return success;
 }
 
 
@@ -304,21 +803,61 @@ byte EtherEventQueueClass::queue(const byte targetIP[], const unsigned int port,
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void EtherEventQueueClass::flushQueue() {
   Serial.println(F("EtherEventQueue.flushQueue"));
+  for (byte counter = 0; counter < queueSize; counter++) {
+    queueSlotBuffersRelease(queueIndex[counter]);
+    queueIndex[counter] = -1;  //set all queueIndex priority levels empty
+  }
   queueSize = 0;
   queueNewCount = 0;
   internalEventQueueCount = 0;
+  rateLimitDeferredCount = 0;
+  sendWindowReset();  //no events are waiting for an ACK anymore
+  if (storage != NULL) {
+    storageFlush();
+  }
+  ETHEREVENTQUEUE_STAGING_SET(stagingHead, ETHEREVENTQUEUE_STAGING_GET(stagingTail));  //discard the staged events, stagingHead is only written by the consumer so this is safe while queueStaged() is used
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setStorage - use persistent storage for events that don't fit in the queue. Must be called before begin().
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setStorage(EtherEventQueueStorage &storageInput) {
+  Serial.println(F("EtherEventQueue.setStorage"));
+  storage = &storageInput;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getStorageCount - returns the number of events in the persistent storage
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::getStorageCount() {
+  return storageCount;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setQueueBuffers - set the number of event and payload buffers shared by the queue slots. F() events and payloads stored by reference don't need a buffer. Must be called before begin().
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setQueueBuffers(const byte eventBufferCount, const byte payloadBufferCount) {
+  Serial.print(F("EtherEventQueue.setQueueBuffers: eventBufferCount="));
+  Serial.print(eventBufferCount);
+  Serial.print(F(" payloadBufferCount="));
+  Serial.println(payloadBufferCount);
+  eventBufferPool.countSetting = eventBufferCount;
+  payloadBufferPool.countSetting = payloadBufferCount;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //checkTimeout - checks all the nodes until it finds a _NEWLY_ timed out node and returns it and then updates the nodeState value for that node. If no nodes are newly timed out then this function returns -1.  Note that this works differently than checkState()
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int8_t EtherEventQueueClass::checkTimeout() {
-  for (byte node = 0; node < nodeCount; node++) {
+int EtherEventQueueClass::checkTimeout() {
+  for (unsigned int node = 0; node < nodeCount; node++) {
     if (!nodeIsSet(node)) {  //node has not been set
       continue;
     }
-    if (nodeState[node] == nodeStateActive && millis() - nodeTimestamp[node] > nodeTimeoutDuration) {  //previous state not timed out, and is currently timed out
+    if (nodeState[node] == nodeStateActive && clockMillis() - nodeTimestamp[node] > nodeTimeout(node)) {  //previous state not timed out, and is currently timed out
       Serial.print(F("EtherEventQueue.checkTimeout: timed out node="));
       Serial.println(node);
       nodeState[node] = nodeStateTimedOut;  //set the node state to inactive
@@ -333,12 +872,12 @@ int8_t EtherEventQueueClass::checkTimeout() {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //checkTimein - checks all the authorized IPs until it finds a _NEWLY_ timed in node and returns it and then updates the nodeState value for that node. If no nodes are newly timed in then this function returns -1.  Note that this works differently than checkState()
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int8_t EtherEventQueueClass::checkTimein() {
-  for (byte node = 0; node < nodeCount; node++) {
+int EtherEventQueueClass::checkTimein() {
+  for (unsigned int node = 0; node < nodeCount; node++) {
     if (!nodeIsSet(node)) {  //node has not been set
       continue;
     }
-    if (nodeState[node] == nodeStateTimedOut && millis() - nodeTimestamp[node] < nodeTimeoutDuration) {  //node is newly timed in(since the last time the function was run)
+    if (nodeState[node] == nodeStateTimedOut && clockMillis() - nodeTimestamp[node] < nodeTimeout(node)) {  //node is newly timed in(since the last time the function was run)
       Serial.print(F("EtherEventQueue.checkTimein: timed in node="));
       Serial.println(node);
       nodeState[node] = nodeStateActive;  //set the node state to active
@@ -353,7 +892,7 @@ int8_t EtherEventQueueClass::checkTimein() {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //checkState - checks if the given node is timed out. Note that this doesn't update the nodeState like checkTimeout()/checkTimein().
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-int8_t EtherEventQueueClass::checkState(const byte node) {
+int8_t EtherEventQueueClass::checkState(const unsigned int node) {
   Serial.print(F("EtherEventQueue.checkTimeoutNode: nodeState for node "));
   Serial.print(node);
   Serial.print(F("="));
@@ -361,7 +900,7 @@ int8_t EtherEventQueueClass::checkState(const byte node) {
     Serial.println(F("invalid node number"));
     return -1;
   }
-  if (millis() - nodeTimestamp[node] > nodeTimeoutDuration) {  //node is not this device, not already timed out, and is timed out
+  if (clockMillis() - nodeTimestamp[node] > nodeTimeout(node)) {  //node is not this device, not already timed out, and is timed out
     Serial.println(F("timed out"));
     return false;
   }
@@ -382,6 +921,80 @@ boolean EtherEventQueueClass::checkQueueOverflow() {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getQueueSize - returns the number of events in the queue
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::getQueueSize() {
+  return queueSize;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getQueueSizeMax - returns the number of queue slots set by begin()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::getQueueSizeMax() {
+  return queueSizeMax;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//removeIf - remove the events for which predicate returns true in a single pass through the queue. Returns the number of events removed.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::removeIf(boolean (*predicate)(const entry_t &entry)) {
+  Serial.println(F("EtherEventQueue.removeIf"));
+  const byte queueSizeBefore = queueSize;
+  const byte newPosition = queueSize - queueNewCount;  //the new events are at the end of the queueIndex
+  byte priorityLevelRemoved = 0;  //removed events at or before queuePriorityLevel
+  byte keepCount = 0;
+  for (byte position = 0; position < queueSizeBefore; position++) {
+    const byte queueSlot = queueIndex[position];
+    if (!predicate(entryGet(queueSlot))) {
+      queueIndex[keepCount] = queueSlot;  //move the kept events up over the removed ones
+      keepCount++;
+      continue;
+    }
+    Serial.print(F("EtherEventQueue.removeIf: queueSlot="));
+    Serial.println(queueSlot);
+    sendWindowRemove(queueSlot);
+    queueSlotBuffersRelease(queueSlot);
+    storageRecordRelease(queueSlot);
+    if ((flagsQueue[queueSlot] & queueFlagRateLimited) && rateLimitDeferredCount > 0) {
+      rateLimitDeferredCount--;
+    }
+    if (IPqueue[queueSlot][0] == nodeIP[nodeDevice][0] && IPqueue[queueSlot][1] == nodeIP[nodeDevice][1] && IPqueue[queueSlot][2] == nodeIP[nodeDevice][2] && IPqueue[queueSlot][3] == nodeIP[nodeDevice][3] && internalEventQueueCount > 0) {  //internal event
+      internalEventQueueCount--;
+    }
+    if (position >= newPosition && queueNewCount > 0) {
+      queueNewCount--;
+    }
+    if (position <= queuePriorityLevel) {
+      priorityLevelRemoved++;
+    }
+  }
+  for (byte position = keepCount; position < queueSizeBefore; position++) {
+    queueIndex[position] = -1;  //clear the emptied positions
+  }
+  queueSize = keepCount;
+
+  //adjust the queuePriorityLevel to account for the revised queueIndex the same as remove()
+  if (queueSize == 0) {
+    queuePriorityLevel = 0;
+  }
+  else if (priorityLevelRemoved > queuePriorityLevel) {  //the event at queuePriorityLevel and all before it were removed
+    queuePriorityLevel = queueSize - 1;
+  }
+  else {
+    queuePriorityLevel -= priorityLevelRemoved;
+  }
+  if (queueHandlerScanRemaining > queueSize) {
+    queueHandlerScanRemaining = queueSize;
+  }
+  Serial.print(F("EtherEventQueue.removeIf: new queue size="));
+  Serial.println(queueSize);
+  return queueSizeBefore - queueSize;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //setResendDelay
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -402,6 +1015,19 @@ unsigned long EtherEventQueueClass::getResendDelay() {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setWorkBudget - limit the work done by each call of queueHandler(), availableEvent() and sendKeepalive(). Unfinished work is resumed on the next call.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setWorkBudget(const byte itemBudget, const unsigned long timeBudget) {
+  Serial.print(F("EtherEventQueue.setWorkBudget: itemBudget="));
+  Serial.print(itemBudget);
+  Serial.print(F(" timeBudget="));
+  Serial.println(timeBudget);
+  workBudgetItems = itemBudget;
+  workBudgetTime = timeBudget;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //setNodeTimeoutDuration
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -423,55 +1049,373 @@ unsigned long EtherEventQueueClass::getNodeTimeoutDuration() {
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//receiveNodesOnly
+//setNodeTimeoutAdaptive - enable or disable per node timeouts calculated from the measured time between communications with each node
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef ethernetclientwithremoteIP_h
-void EtherEventQueueClass::receiveNodesOnly(const boolean receiveNodesOnlyValue) {
-  receiveNodesOnlyState = receiveNodesOnlyValue;
-  Serial.print(F("EtherEventQueue.receiveNodesOnly: new state="));
-  Serial.println(receiveNodesOnlyState);
+boolean EtherEventQueueClass::setNodeTimeoutAdaptive(const boolean enable, const byte deviationFactor, const unsigned long timeoutMin, const unsigned long timeoutMax) {
+  Serial.print(F("EtherEventQueue.setNodeTimeoutAdaptive: enable="));
+  Serial.println(enable);
+  if (!enable) {
+    free(nodeGapMean);
+    free(nodeGapDeviation);
+    nodeGapMean = NULL;
+    nodeGapDeviation = NULL;
+    return true;
+  }
+  nodeTimeoutDeviationFactor = deviationFactor;
+  nodeTimeoutMin = timeoutMin;
+  nodeTimeoutMax = max(timeoutMin, timeoutMax);
+  if (nodeGapMean == NULL) {
+    nodeGapMean = (unsigned long*)calloc(nodeCount, sizeof(unsigned long));  //0 indicates no measurements
+    nodeGapDeviation = (unsigned long*)calloc(nodeCount, sizeof(unsigned long));
+    if (nodeGapMean == NULL || nodeGapDeviation == NULL) {
+      Serial.println(F("EtherEventQueue.setNodeTimeoutAdaptive: memory allocation failed"));
+      free(nodeGapMean);
+      free(nodeGapDeviation);
+      nodeGapMean = NULL;
+      nodeGapDeviation = NULL;
+      return false;
+    }
+  }
+  return true;
 }
-#endif  //ethernetclientwithremoteIP_h
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//sendNodesOnly
+//setDuplicateWindow - remember the eventIDs received from each node for windowDuration so retransmitted events are acknowledged and dropped instead of being received again
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void EtherEventQueueClass::sendNodesOnly(const boolean sendNodesOnlyValue) {
-  sendNodesOnlyState = sendNodesOnlyValue;
-  Serial.print(F("EtherEventQueue.receiveNodesOnly: new state="));
-  Serial.println(sendNodesOnlyState);
+boolean EtherEventQueueClass::setDuplicateWindow(const unsigned long windowDuration, const unsigned int ackPort) {
+  Serial.print(F("EtherEventQueue.setDuplicateWindow: windowDuration="));
+  Serial.println(windowDuration);
+  free(duplicateWindow);
+  free(duplicateTimestamp);
+  duplicateWindow = NULL;
+  duplicateTimestamp = NULL;
+  if (windowDuration == 0) {  //disable
+    return true;
+  }
+#ifndef ethernetclientwithremoteIP_h
+  Serial.println(F("EtherEventQueue.setDuplicateWindow: requires the modified Ethernet library"));  //the sender of an event is not known so there is no window to check it against
+  return false;
+#endif  //ethernetclientwithremoteIP_h
+  duplicateWindow = (byte*)calloc(nodeCount, ackBitsLength);  //a bit for each eventID of each node, the same layout as the ACK bitmap
+  duplicateTimestamp = (unsigned long*)malloc(nodeCount * sizeof(unsigned long));
+  if (duplicateWindow == NULL || duplicateTimestamp == NULL) {
+    Serial.println(F("EtherEventQueue.setDuplicateWindow: memory allocation failed"));
+    free(duplicateWindow);
+    free(duplicateTimestamp);
+    duplicateWindow = NULL;
+    duplicateTimestamp = NULL;
+    return false;
+  }
+  duplicateWindowDuration = windowDuration;
+  duplicateAckPort = ackPort;
+  return true;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//removeNode
+//setSendWindow - limit the number of eventTypeConfirm events that have been sent to a node and not ACKed yet
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void EtherEventQueueClass::removeNode(const byte nodeNumber) {
-  Serial.println(F("EtherEventQueue.removeNode"));
-  if (nodeNumber >= nodeCount) {  //sanity check
-    Serial.println(F("EtherEventQueue.removeNode: invalid node number"));
+boolean EtherEventQueueClass::setSendWindow(const byte windowSize, const boolean adaptive) {
+  Serial.print(F("EtherEventQueue.setSendWindow: windowSize="));
+  Serial.println(windowSize);
+  sendWindowBlockedCount = 0;  //the held back events might fit in the new windows
+  if (windowSize == 0) {  //disable
+    free(nodeWindow);
+    nodeWindow = NULL;
+    sendWindowSize = 0;
+    return true;
   }
-  else {
-    for (byte counter = 0; counter < 4; counter++) {
-      nodeIP[nodeNumber][counter] = 0;
+  if (nodeWindow == NULL) {
+    nodeWindow = (nodeWindow_t*)malloc(nodeCount * sizeof(nodeWindow_t));
+    if (nodeWindow == NULL) {
+      Serial.println(F("EtherEventQueue.setSendWindow: memory allocation failed"));
+      sendWindowSize = 0;
+      return false;
+    }
+    sendWindowSize = windowSize;
+    sendWindowAdaptive = adaptive;
+    sendWindowReset();
+    for (byte queueStep = 0; queueStep < queueSize; queueStep++) {  //count the events that are already waiting for an ACK
+      const byte queueSlot = queueIndex[queueStep];
+      const int node = getNode(IPqueue[queueSlot]);
+      if (node >= 0 && eventTypeQueue[queueSlot] == eventTypeConfirm && (flagsQueue[queueSlot] & queueFlagSent) && nodeWindow[node].inFlight < 255) {
+        nodeWindow[node].inFlight++;
+      }
     }
+    return true;
+  }
+  sendWindowSize = windowSize;
+  sendWindowAdaptive = adaptive;
+  for (unsigned int node = 0; node < nodeCount; node++) {
+    nodeWindow[node].size = adaptive ? min(nodeWindow[node].size, windowSize) : windowSize;
   }
+  return true;
 }
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//getIP
+//getSendWindow - returns the current send window size of the given node
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-IPAddress EtherEventQueueClass::getIP(const byte nodeNumber) {
-  Serial.println(F("EtherEventQueue.getIP"));
-  if (nodeNumber >= nodeCount) {  //sanity check
-    Serial.println(F("EtherEventQueue.getIP: invalid node number"));
-    return IPAddress(0, 0, 0, 0);
+byte EtherEventQueueClass::getSendWindow(const unsigned int nodeNumber) {
+  if (nodeWindow == NULL || nodeNumber >= nodeCount) {
+    return 0;
   }
-  else {
-    return IPAddress(nodeIP[nodeNumber][0], nodeIP[nodeNumber][1], nodeIP[nodeNumber][2], nodeIP[nodeNumber][3]);
+  return nodeWindow[nodeNumber].size;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setClock - use another clock than millis() for all timing, e.g. a virtual clock for simulation. NULL restores millis().
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setClock(unsigned long (*clockFunctionInput)()) {
+  Serial.println(F("EtherEventQueue.setClock"));
+  clockFunction = clockFunctionInput;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setNetwork - send and receive events through the given network instead of EtherEvent
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setNetwork(EtherEventQueueNetwork &networkInput) {
+  Serial.println(F("EtherEventQueue.setNetwork"));
+  network = &networkInput;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setCircuitBreaker - skip events to non-node targets that sends are failing to instead of blocking queueHandler() with a failed connection on every resend
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setCircuitBreaker(const byte failureThreshold, const unsigned long openDuration, const byte breakerCount) {
+  Serial.print(F("EtherEventQueue.setCircuitBreaker: failureThreshold="));
+  Serial.println(failureThreshold);
+  free(circuitBreaker);
+  circuitBreaker = NULL;
+  circuitBreakerCount = 0;
+  if (failureThreshold == 0 || breakerCount == 0) {  //disable
+    return true;
+  }
+  circuitBreaker = (circuit_t*)calloc(breakerCount, sizeof(circuit_t));
+  if (circuitBreaker == NULL) {
+    Serial.println(F("EtherEventQueue.setCircuitBreaker: memory allocation failed"));
+    return false;
+  }
+  circuitBreakerCount = breakerCount;
+  circuitFailureThreshold = failureThreshold;
+  circuitOpenDuration = openDuration;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setRateLimit - limit the sends to the node to burst events at once and one event per tokenInterval after that. tokenInterval 0 removes the limit.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setRateLimit(const unsigned int nodeNumber, const unsigned long tokenInterval, const byte burst, const boolean drop) {
+  Serial.print(F("EtherEventQueue.setRateLimit: nodeNumber="));
+  Serial.println(nodeNumber);
+  if (nodeNumber >= nodeCount) {
+    Serial.println(F("EtherEventQueue.setRateLimit: invalid node number"));
+    return false;
+  }
+  if (nodeRateLimit == NULL) {
+    if (tokenInterval == 0) {  //nothing to remove
+      return true;
+    }
+    nodeRateLimit = (rateLimit_t*)calloc(nodeCount, sizeof(rateLimit_t));  //0 tokenInterval = not rate limited
+    if (nodeRateLimit == NULL) {
+      Serial.println(F("EtherEventQueue.setRateLimit: memory allocation failed"));
+      return false;
+    }
+  }
+  rateLimit_t &rateLimit = nodeRateLimit[nodeNumber];
+  rateLimit.tokenInterval = burst > 0 ? tokenInterval : 0;
+  rateLimit.burst = burst;
+  rateLimit.tokens = burst;  //start with a full bucket
+  rateLimit.refillTimestamp = clockMillis();
+  rateLimit.drop = drop;
+  rateLimitRetryTimestamp = clockMillis();  //the held back events are checked against the new limit
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setRateLimitDefault - the rate limit shared by all targets that are not nodes
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setRateLimitDefault(const unsigned long tokenInterval, const byte burst, const boolean drop) {
+  Serial.print(F("EtherEventQueue.setRateLimitDefault: tokenInterval="));
+  Serial.println(tokenInterval);
+  defaultRateLimit.tokenInterval = burst > 0 ? tokenInterval : 0;
+  defaultRateLimit.burst = burst;
+  defaultRateLimit.tokens = burst;
+  defaultRateLimit.refillTimestamp = clockMillis();
+  defaultRateLimit.drop = drop;
+  rateLimitRetryTimestamp = clockMillis();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getRateLimitTokens - returns the number of events that can be sent to the node now or -1 if it is not rate limited
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int EtherEventQueueClass::getRateLimitTokens(const unsigned int nodeNumber) {
+  if (nodeRateLimit == NULL || nodeNumber >= nodeCount || nodeRateLimit[nodeNumber].tokenInterval == 0) {
+    return -1;
+  }
+  rateLimitRefill(nodeRateLimit[nodeNumber]);
+  return nodeRateLimit[nodeNumber].tokens;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getRateLimitDefaultTokens - returns the number of events that can be sent to non-node targets now or -1 if they are not rate limited
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int EtherEventQueueClass::getRateLimitDefaultTokens() {
+  if (defaultRateLimit.tokenInterval == 0) {
+    return -1;
+  }
+  rateLimitRefill(defaultRateLimit);
+  return defaultRateLimit.tokens;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//rateLimitRefill - add the tokens for the time since the last token was added
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::rateLimitRefill(rateLimit_t &rateLimit) {
+  const unsigned long elapsed = clockMillis() - rateLimit.refillTimestamp;
+  if (elapsed < rateLimit.tokenInterval) {
+    return;
+  }
+  const unsigned long tokensAdded = elapsed / rateLimit.tokenInterval;
+  if (tokensAdded >= (unsigned long)(rateLimit.burst - rateLimit.tokens)) {  //the bucket is full so the time until the next token starts now
+    rateLimit.tokens = rateLimit.burst;
+    rateLimit.refillTimestamp = clockMillis();
+  }
+  else {
+    rateLimit.tokens += tokensAdded;
+    rateLimit.refillTimestamp += tokensAdded * rateLimit.tokenInterval;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//rateLimitAllow - take a token from the rate limit of the target of the event in queueSlot. Returns false if the event was held back or removed because there is no token.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::rateLimitAllow(const int targetNode, const byte queueSlot) {
+  if (targetNode >= 0 && nodeRateLimit == NULL) {  //only the default rate limit is set
+    return true;
+  }
+  rateLimit_t &rateLimit = targetNode >= 0 ? nodeRateLimit[targetNode] : defaultRateLimit;
+  if (rateLimit.tokenInterval == 0) {  //not rate limited
+    return true;
+  }
+  rateLimitRefill(rateLimit);
+  if (rateLimit.tokens > 0) {
+    rateLimit.tokens--;
+    return true;
+  }
+  Serial.println(F("EtherEventQueue.rateLimitAllow: rate limited"));
+  if (rateLimit.drop && (eventTypeQueue[queueSlot] == eventTypeOnce || eventTypeQueue[queueSlot] == eventTypeOverrideTimeout)) {
+    remove(queueSlot);
+    stats.rateLimitDropped++;
+    return false;
+  }
+  const unsigned long tokenTimestamp = rateLimit.refillTimestamp + rateLimit.tokenInterval;  //the time the next token is added
+  if (!(flagsQueue[queueSlot] & queueFlagRateLimited)) {
+    flagsQueue[queueSlot] |= queueFlagRateLimited;
+    rateLimitDeferredCount++;
+    stats.rateLimitDeferred++;
+    if (rateLimitDeferredCount == 1) {  //the first held back event
+      rateLimitRetryTimestamp = tokenTimestamp;
+    }
+  }
+  if ((long)(tokenTimestamp - rateLimitRetryTimestamp) < 0) {
+    rateLimitRetryTimestamp = tokenTimestamp;
+  }
+  return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getNodeTimeout - returns the current timeout duration of the given node
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long EtherEventQueueClass::getNodeTimeout(const unsigned int nodeNumber) {
+  if (nodeNumber >= nodeCount) {  //sanity check
+    Serial.println(F("EtherEventQueue.getNodeTimeout: invalid node number"));
+    return 0;
+  }
+  return nodeTimeout(nodeNumber);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveNodesOnly
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef ethernetclientwithremoteIP_h
+void EtherEventQueueClass::receiveNodesOnly(const boolean receiveNodesOnlyValue) {
+  receiveNodesOnlyState = receiveNodesOnlyValue;
+  Serial.print(F("EtherEventQueue.receiveNodesOnly: new state="));
+  Serial.println(receiveNodesOnlyState);
+}
+#endif  //ethernetclientwithremoteIP_h
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendNodesOnly
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendNodesOnly(const boolean sendNodesOnlyValue) {
+  sendNodesOnlyState = sendNodesOnlyValue;
+  Serial.print(F("EtherEventQueue.receiveNodesOnly: new state="));
+  Serial.println(sendNodesOnlyState);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//removeNode
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::removeNode(const unsigned int nodeNumber) {
+  Serial.println(F("EtherEventQueue.removeNode"));
+  if (nodeNumber >= nodeCount) {  //sanity check
+    Serial.println(F("EtherEventQueue.removeNode: invalid node number"));
+  }
+  else {
+    nodeIndexRemove(nodeNumber);
+    for (byte counter = 0; counter < 4; counter++) {
+      nodeIP[nodeNumber][counter] = 0;
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getIP
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+IPAddress EtherEventQueueClass::getIP(const unsigned int nodeNumber) {
+  Serial.println(F("EtherEventQueue.getIP"));
+  if (nodeNumber >= nodeCount) {  //sanity check
+    Serial.println(F("EtherEventQueue.getIP: invalid node number"));
+    return IPAddress(0, 0, 0, 0);
   }
+  else {
+    return IPAddress(nodeIP[nodeNumber][0], nodeIP[nodeNumber][1], nodeIP[nodeNumber][2], nodeIP[nodeNumber][3]);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setNodes - set count nodes starting from firstNode to the IP addresses in the array. The lookup index is sorted once for all the nodes.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setNodes(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count) {
+  Serial.println(F("EtherEventQueue.setNodes"));
+  return nodesSet(firstNode, nodeIPs, count, false);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setNodes_P - setNodes() for an array in PROGMEM
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setNodes_P(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count) {
+  Serial.println(F("EtherEventQueue.setNodes_P"));
+  return nodesSet(firstNode, nodeIPs, count, true);
 }
 
 
@@ -501,15 +1445,24 @@ void EtherEventQueueClass::sendKeepalive(const unsigned int port) {
     Serial.println(F("EtherEventQueue.sendKeepalive: eventKeepalive not set"));
     return;
   }
-  for (byte node = 0; node < nodeCount; node++) {
+  const unsigned long workTimestamp = micros();
+  unsigned int node = workBudgetEnabled() && sendKeepaliveNode < nodeCount ? sendKeepaliveNode : 0;  //an interrupted check is resumed
+  for (unsigned int counter = 0; counter < nodeCount; counter++, node = node + 1 < nodeCount ? node + 1 : 0) {
+    if (counter > 0 && workBudgetExhausted(counter, workTimestamp)) {
+      sendKeepaliveNode = node;
+      return;
+    }
     if (node == nodeDevice || !nodeIsSet(node)) {  //device node or node has not been set
       continue;
     }
-    if (millis() - nodeTimestamp[node] > nodeTimeoutDuration - sendKeepaliveMargin && millis() - sendKeepaliveTimestamp[node] > sendKeepaliveResendDelay) {  //node is newly timed out(since the last time the function was run)
+    const unsigned long timeout = nodeTimeout(node);
+    if (clockMillis() - nodeTimestamp[node] > timeout - nodeKeepaliveMargin(node, timeout) && clockMillis() - sendKeepaliveTimestamp[node] > sendKeepaliveResendDelay) {  //node is newly timed out(since the last time the function was run)
       Serial.print(F("EtherEventQueue.sendKeepalive: sending to node="));
       Serial.println(node);
-      queue(node, port, eventTypeOverrideTimeout, eventKeepalive);
-      sendKeepaliveTimestamp[node] = millis();
+      if (queue(node, port, eventTypeOverrideTimeout, eventKeepaliveFlash ? value_t((const __FlashStringHelper*)eventKeepalive) : value_t(eventKeepalive))) {
+        stats.keepaliveSent++;
+      }
+      sendKeepaliveTimestamp[node] = clockMillis();
     }
   }
   Serial.println(F("EtherEventQueue.sendKeepalive: no keepalive sent"));
@@ -542,6 +1495,10 @@ unsigned long EtherEventQueueClass::getSendKeepaliveResendDelay() {
 boolean EtherEventQueueClass::setEventKeepalive(const char eventKeepaliveInput[]) {
   Serial.println(F("EtherEventQueue.setEventKeepalive"));
   const byte eventKeepaliveLength = strlen(eventKeepaliveInput);
+  if (eventKeepaliveFlash) {  //the previous keepalive event was not allocated
+    eventKeepalive = NULL;
+    eventKeepaliveFlash = false;
+  }
   eventKeepalive = (char*)realloc(eventKeepalive, (eventKeepaliveLength + 1) * sizeof(*eventKeepalive));  //allocate memory
   if (eventKeepalive == NULL) {
     Serial.println(F("EtherEventQueue.setEventKeepalive: memory allocation failed"));
@@ -580,11 +1537,14 @@ boolean EtherEventQueueClass::setEventKeepalive(const uint32_t eventKeepaliveInp
 }
 
 
-boolean EtherEventQueueClass::setEventKeepalive(const __FlashStringHelper* eventKeepaliveFSH) {
-  byte stringLength = EtherEvent.FSHlength(eventKeepaliveFSH);
-  char eventKeepaliveChar[stringLength + 1];
-  memcpy_P(eventKeepaliveChar, eventKeepaliveFSH, stringLength + 1);  //+1 for the null terminator
-  return setEventKeepalive(eventKeepaliveChar);
+boolean EtherEventQueueClass::setEventKeepalive(const __FlashStringHelper* eventKeepaliveFSH) {  //the F() string is used by reference so no SRAM is needed
+  Serial.println(F("EtherEventQueue.setEventKeepalive(F())"));
+  if (!eventKeepaliveFlash) {
+    free(eventKeepalive);
+  }
+  eventKeepalive = (char*)eventKeepaliveFSH;
+  eventKeepaliveFlash = true;
+  return true;
 }
 
 
@@ -594,6 +1554,10 @@ boolean EtherEventQueueClass::setEventKeepalive(const __FlashStringHelper* event
 boolean EtherEventQueueClass::setEventAck(const char eventAckInput[]) {
   Serial.println(F("EtherEventQueue.setEventAck"));
   const byte eventAckLength = strlen(eventAckInput);
+  if (eventAckFlash) {  //the previous ACK event was not allocated
+    eventAck = NULL;
+    eventAckFlash = false;
+  }
   eventAck = (char*)realloc(eventAck, (eventAckLength + 1) * sizeof(*eventAck));  //allocate memory
   if (eventAck == NULL) {
     Serial.println(F("EtherEventQueue.setEventAck: memory allocation failed"));
@@ -632,11 +1596,14 @@ boolean EtherEventQueueClass::setEventAck(const uint32_t eventAckInput) {
 }
 
 
-boolean EtherEventQueueClass::setEventAck(const __FlashStringHelper* eventAckFSH) {
-  byte stringLength = EtherEvent.FSHlength(eventAckFSH);
-  char eventAckChar[stringLength + 1];
-  memcpy_P(eventAckChar, eventAckFSH, stringLength + 1);  //+1 for the null terminator
-  return setEventAck(eventAckChar);
+boolean EtherEventQueueClass::setEventAck(const __FlashStringHelper* eventAckFSH) {  //the F() string is used by reference so no SRAM is needed
+  Serial.println(F("EtherEventQueue.setEventAck(F())"));
+  if (!eventAckFlash) {
+    free(eventAck);
+  }
+  eventAck = (char*)eventAckFSH;
+  eventAckFlash = true;
+  return true;
 }
 
 
@@ -648,33 +1615,201 @@ void EtherEventQueueClass::setQueueDoubleDecimalPlaces(byte decimalPlaces) {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setPayloadCompression - compress payloads of up to payloadLengthMax chars when they're queued if that makes them shorter. 0 = disable. Only use this for events sent to devices running EtherEventQueue.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setPayloadCompression(const unsigned int payloadLengthMax) {
+  Serial.print(F("EtherEventQueue.setPayloadCompression: payloadLengthMax="));
+  Serial.println(payloadLengthMax);
+  compressionLengthMax = payloadLengthMax;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//compact - mark a number, double or IPAddress payload to be sent in the compact encoding. Only use this for events sent to devices running EtherEventQueue.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+EtherEventQueueClass::value_t EtherEventQueueClass::compact(value_t value) {
+  if (value.type == value_t::typeSigned || value.type == value_t::typeUnsigned || value.type == value_t::typeDouble || value.type == value_t::typeIPAddress) {  //only these types have a compact encoding
+    value.type |= value_t::typeCompactFlag;
+  }
+  return value;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getStats - returns the statistics counters
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const EtherEventQueueClass::stats_t& EtherEventQueueClass::getStats() {
+  Serial.println(F("EtherEventQueue.getStats"));
+  return stats;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getNodeStats - returns the statistics of the given node
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+EtherEventQueueClass::nodeStats_t EtherEventQueueClass::getNodeStats(const unsigned int nodeNumber) {
+  Serial.println(F("EtherEventQueue.getNodeStats"));
+  if (nodeNumber >= nodeCount || nodeStats == NULL) {  //sanity check
+    Serial.println(F("EtherEventQueue.getNodeStats: invalid node number or node statistics disabled"));
+    nodeStats_t nodeStatsEmpty;
+    memset(&nodeStatsEmpty, 0, sizeof(nodeStatsEmpty));
+    return nodeStatsEmpty;
+  }
+  return nodeStats[nodeNumber];
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setNodeStats - enable or disable the per node statistics. The statistics are only allocated while enabled.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setNodeStats(const boolean enable) {
+  Serial.print(F("EtherEventQueue.setNodeStats: enable="));
+  Serial.println(enable);
+  if (!enable) {
+    free(nodeStats);
+    nodeStats = NULL;
+    return true;
+  }
+  if (nodeStats == NULL) {
+    nodeStats = (nodeStats_t*)calloc(max(nodeCount, 1U), sizeof(nodeStats_t));  //at least 1 so it can be enabled before begin(), which resizes it
+    if (nodeStats == NULL) {
+      Serial.println(F("EtherEventQueue.setNodeStats: memory allocation failed"));
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//resetStats - zero all statistics counters
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::resetStats() {
+  Serial.println(F("EtherEventQueue.resetStats"));
+  memset(&stats, 0, sizeof(stats));
+  stats.queueSizeHighWater = queueSize;
+  if (nodeStats != NULL) {
+    memset(nodeStats, 0, nodeCount * sizeof(nodeStats_t));
+  }
+  if (latencyHistogram != NULL) {
+    memset(latencyHistogram, 0, latencyHistogramCount * latencyHistogramBucketCount * sizeof(unsigned long));
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendStats - periodically queue the statistics counters as a comma separated payload to the given node
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendStats(const unsigned int targetNode, const unsigned int port, const value_t &event, const unsigned long interval) {
+  if (clockMillis() - sendStatsTimestamp < interval) {
+    return;
+  }
+  Serial.println(F("EtherEventQueue.sendStats"));
+  sendStatsTimestamp = clockMillis();
+  const unsigned long statsValues[] = {stats.enqueued, stats.sent, stats.sendFailed, stats.resent, stats.ackMatched, stats.ackUnmatched, stats.overflowed, stats.expired, stats.timedOutDropped, stats.keepaliveSent, stats.keepaliveReceived, stats.spilled, stats.ackPiggybacked, stats.duplicateDropped, stats.circuitOpened, stats.compressionSaved, stats.rateLimitDeferred, stats.rateLimitDropped, stats.queueSizeHighWater};
+  const byte statsValuesCount = sizeof(statsValues) / sizeof(statsValues[0]);
+  char payload[statsValuesCount * (uint32_tLengthMax + 1)];  //each value + separator/null terminator
+  payload[0] = 0;
+  for (byte counter = 0; counter < statsValuesCount; counter++) {
+    if (counter > 0) {
+      strcat(payload, ",");
+    }
+    ultoa(statsValues[counter], payload + strlen(payload), 10);
+  }
+  queue(targetNode, port, eventTypeOnce, event, (const char*)payload);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setLatencyHistogram - enable or disable recording of the queue latency histograms. The histogram buckets are only allocated while enabled.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setLatencyHistogram(const boolean enable) {
+  Serial.print(F("EtherEventQueue.setLatencyHistogram: enable="));
+  Serial.println(enable);
+  if (!enable) {
+    free(latencyHistogram);
+    latencyHistogram = NULL;
+    return true;
+  }
+  if (latencyHistogram == NULL) {
+    latencyHistogram = (unsigned long*)calloc(latencyHistogramCount * latencyHistogramBucketCount, sizeof(unsigned long));
+    if (latencyHistogram == NULL) {
+      Serial.println(F("EtherEventQueue.setLatencyHistogram: memory allocation failed"));
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//getLatencyHistogram - returns the number of events recorded in the given bucket of the given histogram
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long EtherEventQueueClass::getLatencyHistogram(const byte histogram, const byte bucket) {
+  if (latencyHistogram == NULL || histogram >= latencyHistogramCount || bucket >= latencyHistogramBucketCount) {  //sanity check
+    Serial.println(F("EtherEventQueue.getLatencyHistogram: disabled or invalid histogram/bucket"));
+    return 0;
+  }
+  return latencyHistogram[histogram * latencyHistogramBucketCount + bucket];
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //private functions
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//eventIDfind - find a free eventID
+//eventIDfind - find a free eventID for an event to targetNode(-1 for a non-node target). The eventIDs are used in rotation, rather than reusing the smallest free eventID, so a retransmission can be told apart from a new event by the receiver's duplicate window.
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-byte EtherEventQueueClass::eventIDfind() {
+byte EtherEventQueueClass::eventIDfind(const int targetNode) {
   Serial.println(F("EtherEventQueue.eventIDfind"));
-  if (queueSize == 0) {  //the queue is empty
-    Serial.println(F("EtherEventQueue.eventIDfind: eventID=10"));
-    return 10;  //default value if there are no other messages
-  }
-  if (queueSize > 0) {
-    for (byte eventID = 10; eventID <= 99; eventID++) {  //step through all possible eventIDs. They start at 10 so they will always be 2 digit
-      byte eventIDduplicate = 0;
-      for (byte count = 0; count < queueSize; count++) {  //step through the currently occupied section of the eventIDqueue[]
-        if (eventID == eventIDqueue[count]) {  //the eventID is already being used
-          eventIDduplicate = 1;
+  byte eventIDsUsed[ackBitsLength];
+  eventIDsUsedFind(eventIDsUsed);
+  return eventIDnext(eventIDsUsed, targetNode);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//eventIDsUsedFind - set the bits of the eventIDs of the events in the queue in the eventIDsUsed bitmap
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::eventIDsUsedFind(byte eventIDsUsed[]) {
+  memset(eventIDsUsed, 0, ackBitsLength);
+  for (byte count = 0; count < queueSize; count++) {  //step through the occupied queue slots
+    const byte queueSlot = queueIndex[count];
+    const byte bitIndex = eventIDqueue[queueSlot] - 10;
+    if (bitIndex < 90) {
+      eventIDsUsed[bitIndex >> 3] |= 1 << (bitIndex & 7);
+    }
+    if (flagsQueue[queueSlot] & queueFlagMulticast) {  //the eventIDs of the other pending destinations are still used by their ACKs
+      const byte* mask = multicastMask + queueSlot * multicastMaskLength();
+      for (unsigned int node = 0; node < nodeCount; node++) {
+        const byte destinationBitIndex = multicastEventID[queueSlot * nodeCount + node] - 10;
+        if ((mask[node >> 3] & (1 << (node & 7))) && destinationBitIndex < 90) {
+          eventIDsUsed[destinationBitIndex >> 3] |= 1 << (destinationBitIndex & 7);
         }
       }
-      if (eventIDduplicate == 0) {  //the eventID was unique
-        Serial.print(F("EtherEventQueue.eventIDfind: eventID="));
-        Serial.println(eventID);
-        return eventID;  //skip the rest of the for loop
-      }
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//eventIDnext - returns the next eventID in the rotation of targetNode(-1 for the shared rotation of the non-node targets) that is not set in the eventIDsUsed bitmap and sets it. The eventIDs used for the other nodes are skipped so the ACKs can still be matched by the eventID alone.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::eventIDnext(byte eventIDsUsed[], const int targetNode) {
+  byte &eventIDprevious = targetNode >= 0 ? nodeEventIDlast[targetNode] : eventIDlast;
+  byte eventID = eventIDprevious;
+  for (byte count = 0; count < 90; count++) {  //step through all possible eventIDs. They start at 10 so they will always be 2 digit
+    eventID = eventID >= 99 ? 10 : eventID + 1;
+    const byte bitIndex = eventID - 10;
+    if (!(eventIDsUsed[bitIndex >> 3] & (1 << (bitIndex & 7)))) {  //the eventID is not being used
+      Serial.print(F("EtherEventQueue.eventIDnext: eventID="));
+      Serial.println(eventID);
+      eventIDsUsed[bitIndex >> 3] |= 1 << (bitIndex & 7);
+      eventIDprevious = eventID;
+      return eventID;
     }
   }
   return 0;  //this should never happen but it causes a compiler warning without
@@ -687,6 +1822,13 @@ byte EtherEventQueueClass::eventIDfind() {
 void EtherEventQueueClass::remove(const byte removeQueueSlot) {
   Serial.print(F("EtherEventQueue.remove: queueSlot="));
   Serial.println(removeQueueSlot);
+  sendWindowRemove(removeQueueSlot);
+  sendWindowBlockedCount = 0;  //the removed event might have opened a send window or been one of the held back new events so the new events are checked again
+  queueSlotBuffersRelease(removeQueueSlot);
+  storageRecordRelease(removeQueueSlot);
+  if ((flagsQueue[removeQueueSlot] & queueFlagRateLimited) && rateLimitDeferredCount > 0) {
+    rateLimitDeferredCount--;
+  }
   if (IPqueue[removeQueueSlot][0] == nodeIP[nodeDevice][0] && IPqueue[removeQueueSlot][1] == nodeIP[nodeDevice][1] && IPqueue[removeQueueSlot][2] == nodeIP[nodeDevice][2] && IPqueue[removeQueueSlot][3] == nodeIP[nodeDevice][3]) {  //the queue item to remove is an internal event
     if (internalEventQueueCount > 0) {  //sanity check
       internalEventQueueCount--;
@@ -707,7 +1849,7 @@ void EtherEventQueueClass::remove(const byte removeQueueSlot) {
     for (counter = removeQueueSlotPriorityLevel; counter < queueSize; counter++) {
       queueIndex[counter] = queueIndex[counter + 1];
     }
-    queueIndex[counter + 1] = -1;  //clear the last slot
+    queueIndex[counter] = -1;  //clear the last slot
 
     //adjust the removeQueueSlotPriorityLevel to account for the revised queueIndex
     if (queuePriorityLevel >= removeQueueSlotPriorityLevel) {
@@ -728,10 +1870,47 @@ void EtherEventQueueClass::remove(const byte removeQueueSlot) {
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//overflowRemove - remove the newest event that is not a multicast event to make room for a new event. Returns the freed queue slot or -1 if all the events in the queue are multicast events, which are not overflowed.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int8_t EtherEventQueueClass::overflowRemove() {
+  int8_t position;
+  for (position = queueSize - 1; position >= 0 && (flagsQueue[queueIndex[position]] & queueFlagMulticast); position--) {}  //multicastNext() moves multicast events to the end of the queue so they would be overflowed first
+  if (position < 0) {
+    Serial.println(F("EtherEventQueue.overflowRemove: all events are multicast events"));
+    return -1;
+  }
+  const int8_t queueSlot = queueIndex[position];
+  if (position >= queueSize - queueNewCount) {  //the overflowed event is a new event
+    queueNewCount--;
+  }
+  remove(queueSlot);
+  return queueSlot;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//entryGet - view of the event in the queue slot for entries() and removeIf()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+EtherEventQueueClass::entry_t EtherEventQueueClass::entryGet(const byte queueSlot) const {
+  entry_t entry;
+  entry.IP = IPqueue[queueSlot];
+  entry.port = portQueue[queueSlot];
+  entry.eventFlash = flagsQueue[queueSlot] & queueFlagEventFlash;
+  entry.event = entry.eventFlash ? flashReference(eventQueue[queueSlot]) : eventQueue[queueSlot];
+  entry.payloadFlash = flagsQueue[queueSlot] & queueFlagPayloadFlash;
+  entry.payload = entry.payloadFlash ? flashReference(payloadQueue[queueSlot]) : payloadQueue[queueSlot];
+  entry.eventID = eventIDqueue[queueSlot];
+  entry.eventType = eventTypeQueue[queueSlot];
+  entry.age = clockMillis() - queueTimestamp[queueSlot];
+  return entry;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //nodeIsSet - check if the node has been set
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-boolean EtherEventQueueClass::nodeIsSet(const byte nodeNumber) {
+boolean EtherEventQueueClass::nodeIsSet(const unsigned int nodeNumber) {
   Serial.print(F("EtherEventQueue.nodeIsSet: result="));
   if (nodeIP[nodeNumber][0] == 0 && nodeIP[nodeNumber][1] == 0 && nodeIP[nodeNumber][2] == 0 && nodeIP[nodeNumber][3] == 0) {
     Serial.println(F("false"));
@@ -743,20 +1922,1747 @@ boolean EtherEventQueueClass::nodeIsSet(const byte nodeNumber) {
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//FSHtoa - convert __FlashStringHelper to char and put it in the passed buffer
+//nodeSet - write the IP address and reset the state of the node. The lookup index is not updated.
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void EtherEventQueueClass::FSHtoa(const __FlashStringHelper* FlashString, char charBuffer[], byte maxLength) {
-  PGM_P FlashString_P = reinterpret_cast<PGM_P>(FlashString);
-  for (byte arrayPosition = 0; arrayPosition < maxLength; arrayPosition++) {
-    unsigned char character = pgm_read_byte(FlashString_P++);
-    charBuffer[arrayPosition] = character;
-    if (character == 0) {
-      return;
+void EtherEventQueueClass::nodeSet(const unsigned int nodeNumber, const byte IP[], const unsigned long timestamp) {
+  nodeIndexRemove(nodeNumber);  //the entry of the previous IP address would break the sort order of the lookup index
+  for (byte counter = 0; counter < 4; counter++) {
+    nodeIP[nodeNumber][counter] = IP[counter];
+  }
+  nodeTimestamp[nodeNumber] = timestamp;
+  sendKeepaliveTimestamp[nodeNumber] = timestamp - sendKeepaliveResendDelay;
+  nodeState[nodeNumber] = nodeStateUnknown;  //start in unknown state
+  if (nodeGapMean != NULL) {
+    nodeGapMean[nodeNumber] = 0;  //no measurements
+    nodeGapDeviation[nodeNumber] = 0;
+  }
+  if (duplicateWindow != NULL) {
+    memset(duplicateWindow + nodeNumber * ackBitsLength, 0, ackBitsLength);  //no received eventIDs
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeTimestampUpdate - record communication with the node
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::nodeTimestampUpdate(const unsigned int node, const unsigned long timestamp) {
+  if (nodeGapMean != NULL && nodeState[node] != nodeStateUnknown) {  //adaptive node timeout is enabled and there has been a previous communication to measure the gap from
+    const unsigned long gap = timestamp - nodeTimestamp[node];
+    if (nodeGapMean[node] == 0) {  //first measurement
+      nodeGapMean[node] = max(gap, 1UL);
+      nodeGapDeviation[node] = gap / 2;
+    }
+    else {  //moving averages with gains of 1/8 and 1/4, the same as the TCP retransmission timeout calculation
+      const long error = gap - nodeGapMean[node];
+      nodeGapMean[node] += error / 8;
+      nodeGapDeviation[node] += ((error < 0 ? -error : error) - (long)nodeGapDeviation[node]) / 4;
     }
   }
-  charBuffer[maxLength] = 0;
+  nodeTimestamp[node] = timestamp;
+  sendKeepaliveTimestamp[node] = timestamp - sendKeepaliveResendDelay;  //Treat successful communication as a sent keepalive so delay the send of the next keepalive. -sendKeepaliveResendDelay is so that sendKeepalive() will be able to queue the eventKeepalive according to "millis() - nodeTimestamp[node] > timeout - keepalive margin" without being blocked by the "millis() - sendKeepaliveTimestamp[node] > sendKeepaliveResendDelay", it will not cause immediate queue of eventKeepalive because nodeTimestamp[node] has just been set.
+  if (nodeState[node] == nodeStateUnknown) {
+    nodeState[node] = nodeStateActive;  //set the node state to active
+  }
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeTimeout - returns the timeout duration of the node. With adaptive node timeout this is the average gap plus deviationFactor times the deviation so a node is only timed out when the silence is unusually long for that node.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long EtherEventQueueClass::nodeTimeout(const unsigned int node) {
+  if (nodeGapMean == NULL || nodeGapMean[node] == 0) {  //disabled or no measurements yet
+    return nodeTimeoutDuration;
+  }
+  if (nodeGapMean[node] >= nodeTimeoutMax || (nodeTimeoutDeviationFactor > 0 && nodeGapDeviation[node] >= (nodeTimeoutMax - nodeGapMean[node]) / nodeTimeoutDeviationFactor)) {  //this also prevents overflow
+    return nodeTimeoutMax;
+  }
+  return max(nodeGapMean[node] + nodeTimeoutDeviationFactor * nodeGapDeviation[node], nodeTimeoutMin);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeKeepaliveMargin - returns the keepalive margin for the node's timeout. The margin is scaled so that it's the same fraction of the timeout as sendKeepaliveMargin is of nodeTimeoutDuration.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned long EtherEventQueueClass::nodeKeepaliveMargin(const unsigned int node, const unsigned long timeout) {
+  if (nodeGapMean == NULL || nodeGapMean[node] == 0 || nodeTimeoutDuration == 0) {
+    return min(sendKeepaliveMargin, timeout);
+  }
+  return (timeout >> 8) * ((sendKeepaliveMargin << 8) / nodeTimeoutDuration);  //1/256 resolution so the multiplication can't overflow
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeFind - returns the node number of the IP address or -1 if it is not a node. Subnet ranges are checked arithmetically, then the lookup index is binary searched.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int EtherEventQueueClass::nodeFind(const uint32_t IPkeyValue) {
+  for (byte range = 0; range < nodeRangeCount; range++) {
+    if ((IPkeyValue & nodeRange[range].mask) == nodeRange[range].network) {
+      const unsigned int node = nodeRange[range].firstNode + (IPkeyValue & ~nodeRange[range].mask);
+      if (IPkey(nodeIP[node]) == IPkeyValue) {  //the node might have been changed or removed after setNodeRange()
+        return node;
+      }
+    }
+  }
+
+  //find the first index position with an IP address >= the IP address. Nodes with the same IP address are sorted by node number so this finds the lowest numbered node.
+  unsigned int low = 0;
+  unsigned int high = nodeIndexCount;
+  while (low < high) {
+    const unsigned int middle = (low + high) / 2;
+    if (IPkey(nodeIP[nodeIndex[middle]]) < IPkeyValue) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  if (low < nodeIndexCount && IPkey(nodeIP[nodeIndex[low]]) == IPkeyValue) {
+    return nodeIndex[low];
+  }
+  Serial.println(F("EtherEventQueue.nodeFind: node not found"));
+  return -1;  //no match
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeIndexInsert - add the node to the lookup index at its sorted position. The node must not be in the index already. Nodes that are not set are not added.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::nodeIndexInsert(const unsigned int nodeNumber) {
+  const uint32_t IPkeyValue = IPkey(nodeIP[nodeNumber]);
+  if (IPkeyValue == 0) {  //0.0.0.0 is not set, e.g. the device node before the IP address is known
+    return;
+  }
+  unsigned int position = nodeIndexCount;
+  while (position > 0) {  //shift the larger entries up to make room
+    const uint32_t previousIPkey = IPkey(nodeIP[nodeIndex[position - 1]]);
+    if (previousIPkey < IPkeyValue || (previousIPkey == IPkeyValue && nodeIndex[position - 1] < nodeNumber)) {
+      break;
+    }
+    nodeIndex[position] = nodeIndex[position - 1];
+    position--;
+  }
+  nodeIndex[position] = nodeNumber;
+  nodeIndexCount++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeIndexRemove - remove the node from the lookup index if it's there. Must be called before the IP address of the node is changed because the entry is found by a binary search for the current IP address.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::nodeIndexRemove(const unsigned int nodeNumber) {
+  const uint32_t IPkeyValue = IPkey(nodeIP[nodeNumber]);
+  unsigned int low = 0;
+  unsigned int high = nodeIndexCount;
+  while (low < high) {  //find the first index position that is not sorted before the node
+    const unsigned int middle = (low + high) / 2;
+    const uint32_t middleIPkey = IPkey(nodeIP[nodeIndex[middle]]);
+    if (middleIPkey < IPkeyValue || (middleIPkey == IPkeyValue && nodeIndex[middle] < nodeNumber)) {
+      low = middle + 1;
+    }
+    else {
+      high = middle;
+    }
+  }
+  if (low == nodeIndexCount || nodeIndex[low] != nodeNumber) {  //not in the index, e.g. a range node
+    return;
+  }
+  nodeIndexCount--;
+  for (unsigned int position = low; position < nodeIndexCount; position++) {
+    nodeIndex[position] = nodeIndex[position + 1];
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodesSet - set the nodes from a RAM or PROGMEM array then sort them into the lookup index. Sorted arrays are indexed in one pass.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::nodesSet(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count, const boolean progmem) {
+  if (firstNode >= nodeCount || count > nodeCount - firstNode) {  //sanity check
+    Serial.println(F("EtherEventQueue.nodesSet: invalid node number"));
+    return false;
+  }
+  const unsigned long timestamp = clockMillis();
+  for (unsigned int counter = 0; counter < count; counter++) {
+    byte IP[4];
+    for (byte octet = 0; octet < 4; octet++) {
+      IP[octet] = progmem ? pgm_read_byte(&nodeIPs[counter][octet]) : nodeIPs[counter][octet];
+    }
+    nodeSet(firstNode + counter, IP, timestamp);
+    nodeIndexInsert(firstNode + counter);  //an insertion sort, each insert only shifts the entries larger than the new one
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeRangeSet - map the subnet to the nodes starting from firstNode. Node firstNode + n is the nth address of the subnet.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::nodeRangeSet(const unsigned int firstNode, const uint32_t network, const byte prefixLength) {
+  Serial.print(F("EtherEventQueue.nodeRangeSet: firstNode="));
+  Serial.println(firstNode);
+  if (prefixLength > 32 || prefixLength == 0) {
+    Serial.println(F("EtherEventQueue.nodeRangeSet: invalid prefix length"));
+    return false;
+  }
+  const uint32_t mask = prefixLength == 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> prefixLength);
+  const uint32_t addressCount = ~mask + 1;
+  if (firstNode >= nodeCount || addressCount > nodeCount - firstNode) {  //sanity check
+    Serial.println(F("EtherEventQueue.nodeRangeSet: range exceeds nodeCount"));
+    return false;
+  }
+  nodeRange_t* nodeRangeNew = (nodeRange_t*)realloc(nodeRange, (nodeRangeCount + 1) * sizeof(nodeRange_t));
+  if (nodeRangeNew == NULL) {
+    Serial.println(F("EtherEventQueue.nodeRangeSet: memory allocation failed"));
+    return false;
+  }
+  nodeRange = nodeRangeNew;
+  nodeRange[nodeRangeCount].network = network & mask;
+  nodeRange[nodeRangeCount].mask = mask;
+  nodeRange[nodeRangeCount].firstNode = firstNode;
+  nodeRangeCount++;
+
+  const unsigned long timestamp = clockMillis();
+  for (unsigned int counter = 0; counter < addressCount; counter++) {
+    if (firstNode + counter == nodeDevice) {  //the device node keeps its IP address
+      continue;
+    }
+    const uint32_t IPkeyValue = (network & mask) + counter;
+    const byte IP[] = {(byte)(IPkeyValue >> 24), (byte)(IPkeyValue >> 16), (byte)(IPkeyValue >> 8), (byte)IPkeyValue};
+    nodeSet(firstNode + counter, IP, timestamp);  //range nodes are found arithmetically so they are not added to the lookup index
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//nodeStatsSendLatency - record the duration of a send to the given node
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::nodeStatsSendLatency(const unsigned int node, const unsigned long sendLatency, const boolean sendSuccess) {
+  if (nodeStats == NULL) {  //node statistics disabled
+    return;
+  }
+  if (sendSuccess) {
+    nodeStats[node].sendCount++;
+  }
+  else {
+    nodeStats[node].sendFailedCount++;
+  }
+  if (sendLatency < nodeStats[node].sendLatencyMin || nodeStats[node].sendCount + nodeStats[node].sendFailedCount == 1) {  //new minimum or first send
+    nodeStats[node].sendLatencyMin = sendLatency;
+  }
+  if (sendLatency > nodeStats[node].sendLatencyMax) {
+    nodeStats[node].sendLatencyMax = sendLatency;
+  }
+  nodeStats[node].sendLatencyTotal += sendLatency;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//latencyHistogramRecord - add the time since the event in the given queue slot was queued to the histogram
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::latencyHistogramRecord(const byte histogram, const byte queueSlot) {
+  if (latencyHistogram == NULL) {  //histograms disabled
+    return;
+  }
+  unsigned long latency = clockMillis() - queueTimestamp[queueSlot];
+  byte bucket = 0;
+  while (latency > 0 && bucket < latencyHistogramBucketCount - 1) {  //bucket = number of significant bits of latency, limited to the last bucket
+    latency >>= 1;
+    bucket++;
+  }
+  latencyHistogram[histogram * latencyHistogramBucketCount + bucket]++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//flashReferenceFits - returns true if value is an F() string that can be stored by reference, which it can if it doesn't need to be truncated to lengthMax
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::flashReferenceFits(const unsigned int lengthMax, const value_t &value) {
+  return value.type == value_t::typeFlashString && strlen_P(reinterpret_cast<PGM_P>(value.data.flashString)) <= lengthMax;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//flashReferenceStore - if value is an F() string that fits in lengthMax without truncation then store the pointer to it in the queue slot instead of copying the string to a buffer in SRAM. Returns true if the reference was stored.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::flashReferenceStore(char* &queueBuffer, const unsigned int lengthMax, const value_t &value) {
+  if (!flashReferenceFits(lengthMax, value)) {
+    return false;
+  }
+  queueBuffer = const_cast<char*>(reinterpret_cast<PGM_P>(value.data.flashString));  //the queue flag tells the reference from a buffer
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//flashReference - returns the F() string pointer stored in the queue slot by flashReferenceStore()
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+PGM_P EtherEventQueueClass::flashReference(const char queueBuffer[]) const {
+  return queueBuffer;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueStringLength - returns the length of the event or payload in the queue buffer
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::queueStringLength(const char queueBuffer[], const boolean flash) {
+  if (flash) {
+    return strlen_P(flashReference(queueBuffer));
+  }
+  return strlen(queueBuffer);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueStringCopy - copy the event or payload in the queue buffer to destination, truncated to lengthMax
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::queueStringCopy(char destination[], const char queueBuffer[], const boolean flash, const unsigned int lengthMax) {
+  if (flash) {
+    value_t(reinterpret_cast<const __FlashStringHelper*>(flashReference(queueBuffer))).write(destination, lengthMax, 0);
+  }
+  else {
+    value_t(queueBuffer).write(destination, lengthMax, 0);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//eventMatch - check if event matches the referenceEvent, which may be an F() string
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::eventMatch(const char event[], const char referenceEvent[], const boolean referenceFlash) {
+  if (referenceFlash) {
+    return strcmp_P(event, referenceEvent) == 0;
+  }
+  return strcmp(event, referenceEvent) == 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//eventIDparse - convert the 2 digit eventID string to byte. Returns 0 if the string doesn't start with 2 digits.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::eventIDparse(const char eventIDchar[]) {
+  if (eventIDchar[0] < '0' || eventIDchar[0] > '9' || eventIDchar[1] < '0' || eventIDchar[1] > '9') {
+    return 0;
+  }
+  return (eventIDchar[0] - '0') * 10 + (eventIDchar[1] - '0');
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receivedPayloadDecode - decode a compact encoded received payload. The string version is created later by availablePayload() if it's needed.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receivedPayloadDecode() {
+  receivedPayloadCompact = receivedPayload[0] == compactMarker && receivedPayloadValueData.readCompact(receivedPayload);
+  if (!receivedPayloadCompact) {  //text payload
+    receivedPayloadValueData = value_t(receivedPayload);
+  }
+  Serial.print(F("EtherEventQueue.receivedPayloadDecode: compact="));
+  Serial.println(receivedPayloadCompact);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//payloadCompress - write the compressed payload to the buffer(sendPayloadLengthMax + 1 chars). Returns false if compression is disabled, the payload is longer than compressionLengthMax or compression doesn't make it shorter, the buffer contents are then undefined.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::payloadCompress(char buffer[], const value_t &payload) {
+  if (compressionLengthMax == 0) {  //disabled
+    return false;
+  }
+  char text[compressionLengthMax + 2];  //one char more than compressionLengthMax to detect longer payloads
+  const unsigned int length = payload.write(text, compressionLengthMax + 1, queueDoubleDecimalPlaces);
+  if (length > compressionLengthMax) {  //compressing a part of the payload would lose the rest, it is sent uncompressed instead
+    return false;
+  }
+  if (length <= compressionMatchLengthMin + 2 || text[0] == compactMarker) {  //too short to compress or already encoded, e.g. a compressed payload replayed from storage
+    return false;
+  }
+
+  unsigned int hashTable[1 << compressionHashBits];  //the last position of each hashed 4 char sequence
+  for (byte counter = 0; counter < (1 << compressionHashBits); counter++) {
+    hashTable[counter] = 0xFFFF;  //no position
+  }
+  const unsigned int compressedLengthMax = min(sendPayloadLengthMax, length - 1);  //the compressed payload must be shorter than the uncompressed one
+  unsigned int compressedLength = 2;
+  unsigned int position = 0;
+  while (position < length) {
+    unsigned int matchLength = 0;
+    unsigned int matchOffset = 0;
+    if (position + compressionMatchLengthMin <= length) {
+      const uint32_t sequence = (byte)text[position] | ((uint32_t)(byte)text[position + 1] << 8) | ((uint32_t)(byte)text[position + 2] << 16) | ((uint32_t)(byte)text[position + 3] << 24);
+      const byte hash = (uint32_t)(sequence * 2654435761UL) >> (32 - compressionHashBits);  //multiplicative hash
+      const unsigned int candidate = hashTable[hash];
+      hashTable[hash] = position;
+      if (candidate != 0xFFFF && position - candidate <= compressionWindow) {
+        const unsigned int matchLengthLimit = min(length - position, (unsigned int)compressionMatchLengthMax);
+        while (matchLength < matchLengthLimit && text[candidate + matchLength] == text[position + matchLength]) {
+          matchLength++;
+        }
+        matchOffset = position - candidate;
+      }
+    }
+    if (matchLength >= compressionMatchLengthMin) {
+      if (compressedLength + 3 > compressedLengthMax) {
+        return false;
+      }
+      buffer[compressedLength++] = compressionEscape;
+      buffer[compressedLength++] = 0x20 + matchOffset - 1;
+      buffer[compressedLength++] = 0x20 + matchLength - compressionMatchLengthMin;
+      position += matchLength;
+    }
+    else {
+      if (compressedLength + (text[position] == compressionEscape ? 2 : 1) > compressedLengthMax) {
+        return false;
+      }
+      if (text[position] == compressionEscape) {
+        buffer[compressedLength++] = compressionEscape;
+      }
+      buffer[compressedLength++] = text[position++];
+    }
+  }
+  buffer[0] = compactMarker;
+  buffer[1] = compressedTag;
+  buffer[compressedLength] = 0;
+  stats.compressionSaved += length - compressedLength;
+  Serial.print(F("EtherEventQueue.payloadCompress: length="));
+  Serial.print(length);
+  Serial.print(F(" compressed="));
+  Serial.println(compressedLength);
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//payloadDecompress - decompress the data written by payloadCompress() after the compactMarker and compressedTag into destination. At most lengthMax chars are written, followed by the null terminator.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::payloadDecompress(char destination[], const char source[], const unsigned int lengthMax) {
+  unsigned int length = 0;
+  while (*source != 0 && length < lengthMax) {
+    if (*source != compressionEscape) {  //literal
+      destination[length++] = *source++;
+    }
+    else if (source[1] == compressionEscape) {  //escaped literal
+      destination[length++] = compressionEscape;
+      source += 2;
+    }
+    else {  //match
+      if (source[1] == 0 || source[2] == 0) {  //truncated
+        break;
+      }
+      const unsigned int matchOffset = (byte)source[1] - 0x20 + 1;
+      unsigned int matchLength = (byte)source[2] - 0x20 + compressionMatchLengthMin;
+      source += 3;
+      if (matchOffset > length) {  //invalid
+        break;
+      }
+      while (matchLength > 0 && length < lengthMax) {  //the match can overlap the chars it writes
+        destination[length] = destination[length - matchOffset];
+        length++;
+        matchLength--;
+      }
+    }
+  }
+  destination[length] = 0;
+  Serial.print(F("EtherEventQueue.payloadDecompress: length="));
+  Serial.println(length);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::write - convert the value to a string in the passed buffer. At most lengthMax chars are written, followed by the null terminator. Returns the string length.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::value_t::write(char buffer[], const unsigned int lengthMax, const byte decimalPlaces) const {
+  unsigned int length = 0;
+  switch (type & ~typeCompactFlag) {  //compact values that are written as a string use the normal conversion
+    case typeString:
+      while (length < lengthMax && data.string[length] != 0) {
+        buffer[length] = data.string[length];
+        length++;
+      }
+      break;
+    case typeFlashString: {
+        PGM_P flashString_P = reinterpret_cast<PGM_P>(data.flashString);
+        while (length < lengthMax) {
+          const char character = pgm_read_byte(flashString_P + length);
+          if (character == 0) {
+            break;
+          }
+          buffer[length++] = character;
+        }
+        break;
+      }
+    case typeSigned:
+      if (data.signedValue < 0) {
+        if (lengthMax == 0) {
+          break;
+        }
+        buffer[length++] = '-';
+        length += writeUnsigned(buffer + length, lengthMax - length, 0UL - (unsigned long)data.signedValue);  //the unsigned negation is correct for the most negative value
+      }
+      else {
+        length = writeUnsigned(buffer, lengthMax, data.signedValue);
+      }
+      break;
+    case typeUnsigned:
+      length = writeUnsigned(buffer, lengthMax, data.unsignedValue);
+      break;
+    case typeDouble:
+      length = writeDouble(buffer, lengthMax, data.doubleValue, decimalPlaces);
+      break;
+    case typeIPAddress:
+      for (byte octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+          if (length == lengthMax) {
+            break;
+          }
+          buffer[length++] = '.';
+        }
+        length += writeUnsigned(buffer + length, lengthMax - length, data.IP[octet]);
+      }
+      break;
+  }
+  buffer[length] = 0;
+  return length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::writeCompact - if the value was marked by EtherEventQueue.compact() write the compact encoding to the buffer: compactMarker, type tag, then the value in 6 bit digits('0' + digit), least significant digit first. Returns the length or 0 if the value is not compact or doesn't fit.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::value_t::writeCompact(char buffer[], const unsigned int lengthMax) const {
+  char tag;
+  unsigned long bits;
+  switch (type) {
+    case typeSigned | typeCompactFlag:
+      tag = 's';
+      bits = ((unsigned long)data.signedValue << 1) ^ (unsigned long)(data.signedValue < 0 ? -1L : 0L);  //zigzag encoding so small negative numbers are short
+      break;
+    case typeUnsigned | typeCompactFlag:
+      tag = 'u';
+      bits = data.unsignedValue;
+      break;
+    case typeDouble | typeCompactFlag: {
+        tag = 'f';
+        const float floatValue = data.doubleValue;  //always sent as 32 bit float
+        uint32_t floatBits;
+        memcpy(&floatBits, &floatValue, sizeof(floatBits));
+        bits = floatBits;
+        break;
+      }
+    case typeIPAddress | typeCompactFlag:
+      tag = 'i';
+      bits = data.IP[0] | ((uint16_t)data.IP[1] << 8) | ((uint32_t)data.IP[2] << 16) | ((uint32_t)data.IP[3] << 24);
+      break;
+    default:
+      return 0;
+  }
+  unsigned int length = 2;  //marker + tag
+  for (unsigned long bitsRemaining = bits; bitsRemaining > 0; bitsRemaining >>= 6) {
+    length++;
+  }
+  if (length > lengthMax) {  //a truncated compact value can't be decoded so fall back to the string version
+    return 0;
+  }
+  buffer[0] = compactMarker;
+  buffer[1] = tag;
+  for (unsigned int position = 2; position < length; position++) {
+    buffer[position] = '0' + (bits & 0x3F);
+    bits >>= 6;
+  }
+  buffer[length] = 0;
+  return length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::readCompact - decode the compact encoding written by writeCompact(). Returns false if buffer is not a valid compact encoding.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::value_t::readCompact(const char buffer[]) {
+  if (buffer[1] == 0) {  //no type tag
+    return false;
+  }
+  unsigned long bits = 0;
+  byte shift = 0;
+  for (const char* digit = buffer + 2; *digit != 0; digit++) {
+    if (*digit < '0' || *digit > '0' + 0x3F || shift >= sizeof(bits) * 8) {  //invalid digit or too long
+      return false;
+    }
+    bits |= (unsigned long)(*digit - '0') << shift;
+    shift += 6;
+  }
+  switch (buffer[1]) {
+    case 's':
+      type = typeSigned;
+      data.signedValue = (long)(bits >> 1) ^ -(long)(bits & 1);
+      return true;
+    case 'u':
+      type = typeUnsigned;
+      data.unsignedValue = bits;
+      return true;
+    case 'f': {
+        type = typeDouble;
+        const uint32_t floatBits = bits;
+        float floatValue;
+        memcpy(&floatValue, &floatBits, sizeof(floatValue));
+        data.doubleValue = floatValue;
+        return true;
+      }
+    case 'i':
+      type = typeIPAddress;
+      for (byte octet = 0; octet < 4; octet++) {
+        data.IP[octet] = bits >> (octet * 8);
+      }
+      return true;
+  }
+  return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::writeDigits - write exactly digitCount digits of number(zero padded) to the buffer. The digits are found by subtracting the powers of 10 from the table to avoid slow long division on 8 bit microcontrollers.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::value_t::writeDigits(char buffer[], const unsigned int lengthMax, unsigned long number, byte digitCount) {
+  unsigned int length = 0;
+  for (; digitCount > 0 && length < lengthMax; digitCount--) {  //most significant digit first
+    const unsigned long powerOf10 = pgm_read_dword(&powersOf10[digitCount - 1]);
+    char digit = '0';
+    while (number >= powerOf10) {
+      number -= powerOf10;
+      digit++;
+    }
+    buffer[length++] = digit;
+  }
+  return length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::writeUnsigned - write the decimal representation of number to the buffer
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::value_t::writeUnsigned(char buffer[], const unsigned int lengthMax, const unsigned long number) {
+  byte digitCount = 1;
+  while (digitCount < powersOf10Count && number >= pgm_read_dword(&powersOf10[digitCount])) {
+    digitCount++;
+  }
+  return writeDigits(buffer, lengthMax, number, digitCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//value_t::writeDouble - write number to the buffer in fixed point notation with the given number of decimal places
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::value_t::writeDouble(char buffer[], const unsigned int lengthMax, double number, byte decimalPlaces) {
+  unsigned int length = 0;
+  if (number < 0) {
+    if (lengthMax == 0) {
+      return 0;
+    }
+    buffer[length++] = '-';
+    number = -number;
+  }
+  if (isnan(number) || isinf(number)) {
+    const char* special = isnan(number) ? "nan" : "inf";
+    for (byte counter = 0; counter < 3 && length < lengthMax; counter++) {
+      buffer[length++] = special[counter];
+    }
+    return length;
+  }
+  decimalPlaces = min(decimalPlaces, powersOf10Count - 1);  //limited by the size of the powers of 10 table
+  const unsigned long decimalScale = pgm_read_dword(&powersOf10[decimalPlaces]);
+  number += 0.5 / decimalScale;  //round to the last decimal place
+
+  if (number < 4294967296.0) {  //the integer part fits in an unsigned long
+    const unsigned long integerPart = number;
+    length += writeUnsigned(buffer + length, lengthMax - length, integerPart);
+    number -= integerPart;
+  }
+  else {  //larger values are converted one digit at a time
+    double powerOf10 = 1;
+    while (powerOf10 * 10 <= number) {
+      powerOf10 *= 10;
+    }
+    for (; powerOf10 >= 1; powerOf10 /= 10) {
+      byte digit = number / powerOf10;
+      digit = min(digit, 9);  //floating point error protection
+      number -= digit * powerOf10;
+      if (length < lengthMax) {
+        buffer[length++] = '0' + digit;
+      }
+    }
+    number = max(number, 0);
+  }
+
+  if (decimalPlaces > 0 && length < lengthMax) {
+    buffer[length++] = '.';
+    const unsigned long fraction = number * decimalScale;
+    length += writeDigits(buffer + length, lengthMax - length, min(fraction, decimalScale - 1), decimalPlaces);  //floating point error protection
+  }
+  return length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageBegin - check the storage format and find the stored events. The records are written in a ring so the newest record is the one not followed by the next sequence number.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageBegin() {
+  storageRecordLength = storageRecordHeaderLength + sendEventLengthMax + sendPayloadLengthMax;
+  storageRecordCount = storage->length() > storageHeaderLength ? (storage->length() - storageHeaderLength) / storageRecordLength : 0;
+  storageHead = 0;
+  storageTail = 0;
+  storageUsed = 0;
+  storageReplayRecord = 0;
+  storageCount = 0;
+  storageSequence = 0;
+  Serial.print(F("EtherEventQueue.storageBegin: storageRecordCount="));
+  Serial.println(storageRecordCount);
+  if (storageRecordCount == 0) {  //the storage is too small to hold a record
+    return;
+  }
+  if (storageReadWord(0) != storageRecordLength) {  //new storage or the buffer lengths have changed so the records can't be read
+    Serial.println(F("EtherEventQueue.storageBegin: format"));
+    for (unsigned int record = 0; record < storageRecordCount; record++) {
+      storage->write(storageRecordAddress(record), storageStateEmpty);
+    }
+    storageWriteWord(0, storageRecordLength);
+    storage->commit();
+    return;
+  }
+
+  unsigned int newestRecord = storageRecordCount;  //storageRecordCount indicates no records have been written
+  for (unsigned int record = 0; record < storageRecordCount; record++) {
+    const unsigned int address = storageRecordAddress(record);
+    if (storage->read(address) == storageStateEmpty) {
+      continue;
+    }
+    const unsigned int nextAddress = storageRecordAddress(record + 1 < storageRecordCount ? record + 1 : 0);
+    if (storage->read(nextAddress) == storageStateEmpty || storageReadWord(nextAddress + 1) != (uint16_t)(storageReadWord(address + 1) + 1)) {
+      newestRecord = record;
+      break;
+    }
+  }
+  if (newestRecord == storageRecordCount) {  //the storage is empty
+    return;
+  }
+  storageHead = newestRecord + 1 < storageRecordCount ? newestRecord + 1 : 0;
+  storageSequence = storageReadWord(storageRecordAddress(newestRecord) + 1) + 1;
+  if (storage->read(storageRecordAddress(newestRecord)) != storageStateValid) {  //the newest record might not be valid if the power failed while it was written so it is overwritten by the next stored event
+    storageHead = newestRecord;
+    storageSequence--;
+  }
+
+  //the records in use are the ones from the oldest valid record to the newest. Replayed records are consumed except for eventTypeConfirm events that were waiting for an ACK, so those are replayed again.
+  unsigned int record = storageHead;
+  for (unsigned int counter = 1; counter <= storageRecordCount; counter++) {
+    record = record > 0 ? record - 1 : storageRecordCount - 1;
+    if (storage->read(storageRecordAddress(record)) == storageStateValid) {  //records are never overwritten while they are valid so all valid records are in use
+      storageCount++;
+      storageUsed = counter;
+    }
+  }
+  storageTail = storageHead >= storageUsed ? storageHead - storageUsed : storageHead + storageRecordCount - storageUsed;
+  storageReplayRecord = storageTail;
+  Serial.print(F("EtherEventQueue.storageBegin: storageCount="));
+  Serial.println(storageCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageAppend - write the event to the next record of the storage
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::storageAppend(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  if (storageUsed >= storageRecordCount) {
+    Serial.println(F("EtherEventQueue.storageAppend: storage full"));
+    return false;
+  }
+  Serial.print(F("EtherEventQueue.storageAppend: record="));
+  Serial.println(storageHead);
+  const unsigned int address = storageRecordAddress(storageHead);
+  for (byte counter = 0; counter < 4; counter++) {
+    storage->write(address + 3 + counter, targetIP[counter]);
+  }
+  storageWriteWord(address + 7, port);
+  storage->write(address + 9, eventType);
+  char buffer[max((unsigned int)sendEventLengthMax, sendPayloadLengthMax) + 1];  //the values are converted to strings so F() strings and compact payloads are stored by value
+  event.write(buffer, sendEventLengthMax, queueDoubleDecimalPlaces);
+  storageWriteString(address + storageRecordHeaderLength, buffer, sendEventLengthMax);
+  if (payload.writeCompact(buffer, sendPayloadLengthMax) == 0 && !payloadCompress(buffer, payload)) {  //not a compact or compressed payload
+    payload.write(buffer, sendPayloadLengthMax, queueDoubleDecimalPlaces);
+  }
+  storageWriteString(address + storageRecordHeaderLength + sendEventLengthMax, buffer, sendPayloadLengthMax);
+  storageWriteWord(address + 1, storageSequence);
+  storage->write(address, storageStateValid);  //the state is written last so that a partially written record is never replayed
+  storage->commit();
+
+  storageHead = storageHead + 1 < storageRecordCount ? storageHead + 1 : 0;
+  storageSequence++;
+  storageUsed++;
+  storageCount++;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageReplay - move the oldest stored events to the free queue slots. A record is only consumed once its event is in the queue. eventTypeConfirm events stay in the storage until they leave the queue so they are not lost by a reset while waiting for the ACK.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageReplay(const unsigned long workTimestamp) {
+  Serial.println(F("EtherEventQueue.storageReplay"));
+  char event[sendEventLengthMax + 1];
+  char payload[sendPayloadLengthMax + 1];
+  for (byte replayCount = 0; storageCount > 0 && queueSize < queueSizeMax; replayCount++) {
+    if (replayCount > 0 && workBudgetExhausted(replayCount, workTimestamp)) {  //the rest are replayed by the next call
+      break;
+    }
+    const unsigned int record = storageReplayRecord;
+    const unsigned int address = storageRecordAddress(record);
+    if (storage->read(address) != storageStateValid) {  //consumed while an older eventTypeConfirm event was kept, this only happens after a reset
+      storageReplayRecord = record + 1 < storageRecordCount ? record + 1 : 0;
+      continue;
+    }
+    byte targetIP[4];
+    for (byte counter = 0; counter < 4; counter++) {
+      targetIP[counter] = storage->read(address + 3 + counter);
+    }
+    const unsigned int port = storageReadWord(address + 7);
+    const byte eventType = storage->read(address + 9);
+    const int targetNode = getNode(targetIP);
+    if (targetNode >= 0 && (unsigned int)targetNode != nodeDevice && clockMillis() - nodeTimestamp[targetNode] > nodeTimeout(targetNode) && eventType != eventTypeOverrideTimeout) {  //events to timed out nodes are dropped the same as the events in the queue
+      Serial.println(F("EtherEventQueue.storageReplay: timed out node"));
+      storage->write(address, storageStateConsumed);
+      stats.timedOutDropped++;
+    }
+    else {
+      storageReadString(event, address + storageRecordHeaderLength, sendEventLengthMax);
+      storageReadString(payload, address + storageRecordHeaderLength + sendEventLengthMax, sendPayloadLengthMax);
+      storageReplaying = true;  //prevent queue() from storing the event again
+      const byte success = queue((const byte*)targetIP, port, eventType, (const char*)event, (const char*)payload);
+      storageReplaying = false;
+      if (success == false) {  //queue() only rejects events because of the configuration(e.g. sendNodesOnly() or no eventAck) so retrying would block the replay of the later records, a full queue ends the loop before the record is read
+        Serial.println(F("EtherEventQueue.storageReplay: rejected by queue(), discarded"));
+        storage->write(address, storageStateConsumed);
+      }
+      else if (eventType == eventTypeConfirm) {  //the record is consumed when the event is removed from the queue
+        storageRecordQueue[queueIndex[queueSize - 1]] = record;
+      }
+      else {
+        storage->write(address, storageStateConsumed);
+      }
+    }
+    storageReplayRecord = record + 1 < storageRecordCount ? record + 1 : 0;
+    storageCount--;
+  }
+  storageTrim();
+  storage->commit();  //all the consumed records are committed together
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageFlush - discard all stored events
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageFlush() {
+  Serial.println(F("EtherEventQueue.storageFlush"));
+  while (storageUsed > 0) {
+    const unsigned int address = storageRecordAddress(storageTail);
+    if (storage->read(address) == storageStateValid) {
+      storage->write(address, storageStateConsumed);
+    }
+    storageTail = storageTail + 1 < storageRecordCount ? storageTail + 1 : 0;
+    storageUsed--;
+  }
+  storageReplayRecord = storageTail;
+  storageCount = 0;
+  for (byte counter = 0; counter < queueSizeMax; counter++) {
+    storageRecordQueue[counter] = storageRecordNone;
+  }
+  storage->commit();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageRecordRelease - consume the record of the replayed eventTypeConfirm event in the queue slot when the event is removed from the queue
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageRecordRelease(const byte queueSlot) {
+  if (storageRecordQueue == NULL || storageRecordQueue[queueSlot] == storageRecordNone) {
+    return;
+  }
+  Serial.print(F("EtherEventQueue.storageRecordRelease: record="));
+  Serial.println(storageRecordQueue[queueSlot]);
+  storage->write(storageRecordAddress(storageRecordQueue[queueSlot]), storageStateConsumed);
+  storageRecordQueue[queueSlot] = storageRecordNone;
+  storageTrim();
+  storage->commit();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageTrim - free the consumed records at the old end of the records in use so they can be written again
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageTrim() {
+  while (storageUsed > 0 && storage->read(storageRecordAddress(storageTail)) != storageStateValid) {
+    if (storageReplayRecord == storageTail) {  //a record consumed before the reset doesn't need to be replayed
+      storageReplayRecord = storageTail + 1 < storageRecordCount ? storageTail + 1 : 0;
+    }
+    storageTail = storageTail + 1 < storageRecordCount ? storageTail + 1 : 0;
+    storageUsed--;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageRecordAddress - returns the storage address of the given record
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::storageRecordAddress(const unsigned int record) {
+  return storageHeaderLength + record * storageRecordLength;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageReadWord/storageWriteWord - 16 bit values are stored low byte first
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+uint16_t EtherEventQueueClass::storageReadWord(const unsigned int address) {
+  return storage->read(address) | (storage->read(address + 1) << 8);
+}
+
+
+void EtherEventQueueClass::storageWriteWord(const unsigned int address, const uint16_t value) {
+  storage->write(address, value & 0xFF);
+  storage->write(address + 1, value >> 8);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//storageReadString/storageWriteString - strings are stored in a field of lengthMax bytes with a null terminator only if they are shorter. Only the used part of the field is written to reduce wear.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::storageReadString(char destination[], const unsigned int address, const unsigned int lengthMax) {
+  unsigned int counter;
+  for (counter = 0; counter < lengthMax; counter++) {
+    destination[counter] = storage->read(address + counter);
+    if (destination[counter] == 0) {
+      return;
+    }
+  }
+  destination[counter] = 0;
+}
+
+
+void EtherEventQueueClass::storageWriteString(const unsigned int address, const char string[], const unsigned int lengthMax) {
+  for (unsigned int counter = 0; counter < lengthMax; counter++) {
+    storage->write(address + counter, string[counter]);
+    if (string[counter] == 0) {
+      return;
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueAck - queue an ACK for a received eventTypeConfirm event. The eventID is added to an ACK to the same target that has not been sent yet, if there is one, so several events are confirmed by a single ACK.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//convert IPAddress to 4 byte array
+byte EtherEventQueueClass::queueAck(const IPAddress &targetIPAddress, const unsigned int port, const byte eventID) {
+  byte targetIP[4];  //create buffer
+  IPcopy(targetIP, targetIPAddress);  //convert
+  return queueAck((const byte*)targetIP, port, eventID);
+}
+
+
+//convert node to 4 byte array
+byte EtherEventQueueClass::queueAck(const unsigned int targetNode, const unsigned int port, const byte eventID) {
+  if (targetNode >= nodeCount || !nodeIsSet(targetNode)) {  //sanity check
+    Serial.println(F("EtherEventQueue.queueAck(convert node): invalid node number"));
+    return false;
+  }
+  return queueAck((const byte*)nodeIP[targetNode], port, eventID);
+}
+
+
+//main queueAck() function
+byte EtherEventQueueClass::queueAck(const byte targetIP[], const unsigned int port, const byte eventID) {
+  Serial.print(F("EtherEventQueue.queueAck: eventID="));
+  Serial.println(eventID);
+  if (eventAck == NULL || eventID < 10 || eventID > 99 || sendPayloadLengthMax < eventIDlength) {  //sanity check
+    Serial.println(F("EtherEventQueue.queueAck: invalid"));
+    return false;
+  }
+  const int8_t ackSlot = ackSlotFind(targetIP, port);
+  if (ackSlot >= 0 && ackAppend(payloadQueue[ackSlot], eventID)) {
+    Serial.print(F("EtherEventQueue.queueAck: added to pending ack="));
+    Serial.println(payloadQueue[ackSlot]);
+    return true;
+  }
+  char ackList[eventIDlength + 1];
+  itoa(eventID, ackList, 10);
+  const unsigned long enqueuedCount = stats.enqueued;
+  const byte success = queue(targetIP, port, eventTypeRepeat, eventAckFlash ? value_t((const __FlashStringHelper*)eventAck) : value_t(eventAck), value_t((const char*)ackList));
+  if (stats.enqueued != enqueuedCount) {  //the ack was put in the queue rather than in the storage so later eventIDs can be added to it
+    flagsQueue[queueIndex[queueSize - 1]] |= queueFlagAck;
+  }
+  return success;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setAckPiggyback - send the ACKs queued by queueAck() along with other events to the same target instead of as separate events
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::setAckPiggyback(const boolean ackPiggybackInput) {
+  Serial.print(F("EtherEventQueue.setAckPiggyback: ackPiggybackInput="));
+  Serial.println(ackPiggybackInput);
+  ackPiggyback = ackPiggybackInput;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueMulticast - queue an event to all nodes in nodeMask(bit n of the array is node n, NULL = all nodes). The event and payload are stored once in a single queue slot and queueHandler() sends them to one destination at a time.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::queueMulticast(const byte nodeMask[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  Serial.println(F("EtherEventQueue.queueMulticast"));
+#ifndef ethernetclientwithremoteIP_h
+  if (eventType == eventTypeConfirm) {  //the ACKs can't be matched to the destinations without the sender IP
+    Serial.println(F("EtherEventQueue.queueMulticast: eventTypeConfirm requires the modified Ethernet library"));
+    return false;
+  }
+#endif  //ethernetclientwithremoteIP_h
+  if (queueSize == queueSizeMax || storageCount > 0 || !queueBuffersAvailable(event, payload)) {  //multicast events are not overflowed or stored
+    Serial.println(F("EtherEventQueue.queueMulticast: queue full"));
+    return false;
+  }
+  if (multicastMask == NULL) {
+    multicastMask = (byte*)malloc(queueSizeMax * multicastMaskLength());
+    multicastEventID = (byte*)malloc(queueSizeMax * nodeCount);
+    if (multicastMask == NULL || multicastEventID == NULL) {
+      Serial.println(F("EtherEventQueue.queueMulticast: memory allocation failed"));
+      free(multicastMask);
+      free(multicastEventID);
+      multicastMask = NULL;
+      multicastEventID = NULL;
+      return false;
+    }
+  }
+
+  byte mask[multicastMaskLength()];  //copied to the queue slot once queue() has written it
+  memset(mask, 0, sizeof(mask));
+  int firstNode = -1;
+  unsigned int destinationCount = 0;
+  for (unsigned int node = 0; node < nodeCount; node++) {
+    if ((nodeMask != NULL && !(nodeMask[node >> 3] & (1 << (node & 7)))) || node == nodeDevice || !nodeIsSet(node)) {
+      continue;
+    }
+    if (eventType != eventTypeOverrideTimeout && clockMillis() - nodeTimestamp[node] > nodeTimeout(node)) {  //events are not queued to timed out nodes
+      continue;
+    }
+    mask[node >> 3] |= 1 << (node & 7);
+    if (firstNode < 0) {
+      firstNode = node;
+    }
+    destinationCount++;
+  }
+  Serial.print(F("EtherEventQueue.queueMulticast: destinationCount="));
+  Serial.println(destinationCount);
+  if (destinationCount == 0) {
+    return false;
+  }
+  unsigned int eventIDsReserved = destinationCount + queueSizeMax - queueSize - 1;  //each destination gets its own eventID and each empty slot needs one for a later event
+  for (byte position = 0; position < queueSize; position++) {
+    const byte otherSlot = queueIndex[position];
+    if (flagsQueue[otherSlot] & queueFlagMulticast) {  //an eventID for each pending destination
+      const byte* otherMask = multicastMask + otherSlot * multicastMaskLength();
+      for (unsigned int node = 0; node < nodeCount; node++) {
+        if (otherMask[node >> 3] & (1 << (node & 7))) {
+          eventIDsReserved++;
+        }
+      }
+    }
+    else {
+      eventIDsReserved++;
+    }
+  }
+  if (eventIDsReserved > 90) {  //the 2 digit eventIDs would run out
+    Serial.println(F("EtherEventQueue.queueMulticast: not enough eventIDs"));
+    return false;
+  }
+
+  if (!queue((const byte*)nodeIP[firstNode], port, eventType, event, payload)) {  //queue() sanity checks the eventType
+    return false;
+  }
+  const byte queueSlot = queueIndex[queueSize - 1];  //the queue wasn't full so queue() added the event at the end
+  if (destinationCount > 1) {  //a single destination is an ordinary event
+    memcpy(multicastMask + queueSlot * multicastMaskLength(), mask, sizeof(mask));
+    memset(multicastEventID + queueSlot * nodeCount, 0, nodeCount);  //the other destinations get their eventIDs when they are attempted
+    multicastEventID[queueSlot * nodeCount + firstNode] = eventIDqueue[queueSlot];  //queue() took it from the rotation of the first destination
+    flagsQueue[queueSlot] |= queueFlagMulticast;
+  }
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//setStagingQueue - allocate the ring buffer for queueStaged(). Must be called before any interrupt or task that calls queueStaged() is started.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::setStagingQueue(const byte slotCount, const byte stringLengthMax) {
+  Serial.print(F("EtherEventQueue.setStagingQueue: slotCount="));
+  Serial.print(slotCount);
+  Serial.print(F(" stringLengthMax="));
+  Serial.println(stringLengthMax);
+  free(stagingQueue);
+  free(stagingStrings);
+  stagingQueue = NULL;
+  stagingStrings = NULL;
+  stagingQueueLength = 0;
+  stagingStringLengthMax = 0;
+  stagingHead = 0;
+  stagingTail = 0;
+  if (slotCount == 0) {  //disable
+    return true;
+  }
+  if (slotCount == 255) {  //the ring needs one more slot than slotCount
+    Serial.println(F("EtherEventQueue.setStagingQueue: slotCount too large"));
+    return false;
+  }
+  stagingQueue = (queueRecord_t*)calloc(slotCount + 1, sizeof(queueRecord_t));
+  if (stringLengthMax > 0) {  //the producer can change a char array string before queueHandler() queues the event so it has to be copied
+    stagingStrings = (char*)malloc((slotCount + 1) * 2 * (stringLengthMax + 1));
+  }
+  if (stagingQueue == NULL || (stringLengthMax > 0 && stagingStrings == NULL)) {
+    Serial.println(F("EtherEventQueue.setStagingQueue: memory allocation failed"));
+    free(stagingQueue);
+    free(stagingStrings);
+    stagingQueue = NULL;
+    stagingStrings = NULL;
+    return false;
+  }
+  stagingQueueLength = slotCount + 1;
+  stagingStringLengthMax = stringLengthMax;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//queueStaged - stage an event for queueHandler() to queue. Lock-free so it can be called from one interrupt handler or task while the rest of EtherEventQueue is used by the main program. There is no debug output because Serial can't be used from an interrupt. Returns false if the staging queue is disabled or full.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::queueStaged(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  return stagingAppend(-1, targetIP, port, eventType, event, payload);
+}
+
+
+//node target, the node is checked when the event is queued
+boolean EtherEventQueueClass::queueStaged(const unsigned int targetNode, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  const byte targetIP[4] = {0, 0, 0, 0};  //not used
+  return stagingAppend(targetNode, targetIP, port, eventType, event, payload);
+}
+
+
+//convert IPAddress to 4 byte array
+boolean EtherEventQueueClass::queueStaged(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  const byte targetIP[4] = {targetIPAddress[0], targetIPAddress[1], targetIPAddress[2], targetIPAddress[3]};  //IPcopy() is not used because of its debug output
+  return stagingAppend(-1, targetIP, port, eventType, event, payload);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//stagingAppend - the producer side of the staging queue. Returns false if the staging queue is disabled or full, or the event or payload is a char array string and setStagingQueue() didn't allocate string buffers.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::stagingAppend(const int targetNode, const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload) {
+  if (stagingQueue == NULL) {
+    return false;
+  }
+  if (stagingStrings == NULL && (event.type == value_t::typeString || payload.type == value_t::typeString)) {  //the string would only be copied when the event is queued
+    return false;
+  }
+  const byte tail = stagingTail;
+  const byte tailNext = tail + 1 < stagingQueueLength ? tail + 1 : 0;
+  if (tailNext == ETHEREVENTQUEUE_STAGING_GET(stagingHead)) {  //full, the slot of stagingHead is not read yet
+    return false;
+  }
+  queueRecord_t &stagedEvent = stagingQueue[tail];
+  stagedEvent.targetNode = targetNode;
+  for (byte counter = 0; counter < 4; counter++) {
+    stagedEvent.targetIP[counter] = targetIP[counter];
+  }
+  stagedEvent.port = port;
+  stagedEvent.eventType = eventType;
+  if (stagingStrings != NULL) {
+    char* eventString = stagingStrings + tail * 2 * (stagingStringLengthMax + 1);
+    stagedEvent.event = stagingValueCopy(event, eventString);
+    stagedEvent.payload = stagingValueCopy(payload, eventString + stagingStringLengthMax + 1);
+  }
+  else {
+    stagedEvent.event = event;
+    stagedEvent.payload = payload;
+  }
+  ETHEREVENTQUEUE_STAGING_SET(stagingTail, tailNext);  //the record is complete before the consumer can see it
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//stagingValueCopy - char array strings are copied to the string buffer of the staging slot, longer strings are truncated to stagingStringLengthMax. Other values are stored in the value_t.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+EtherEventQueueClass::value_t EtherEventQueueClass::stagingValueCopy(const value_t &value, char buffer[]) {
+  if (value.type != value_t::typeString) {
+    return value;
+  }
+  strncpy(buffer, value.data.string, stagingStringLengthMax);
+  buffer[stagingStringLengthMax] = 0;
+  return value_t((const char*)buffer);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//stagingMove - queue the events staged by queueStaged() while there are free queue slots
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::stagingMove(const unsigned long workTimestamp) {
+  for (unsigned int counter = 0; stagingHead != ETHEREVENTQUEUE_STAGING_GET(stagingTail) && queueSize < queueSizeMax; counter++) {
+    if (counter > 0 && workBudgetExhausted(counter, workTimestamp)) {
+      return;
+    }
+    const byte head = stagingHead;
+    const queueRecord_t &stagedEvent = stagingQueue[head];
+    Serial.println(F("EtherEventQueue.stagingMove"));
+    if (stagedEvent.targetNode >= 0) {
+      queue((unsigned int)stagedEvent.targetNode, stagedEvent.port, stagedEvent.eventType, stagedEvent.event, stagedEvent.payload);
+    }
+    else {
+      queue(stagedEvent.targetIP, stagedEvent.port, stagedEvent.eventType, stagedEvent.event, stagedEvent.payload);
+    }
+    ETHEREVENTQUEUE_STAGING_SET(stagingHead, head + 1 < stagingQueueLength ? head + 1 : 0);  //the record is read before the producer can reuse the slot
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackSlotFind - returns the queue slot of the ACK queued by queueAck() to the target or -1 if there is none
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int8_t EtherEventQueueClass::ackSlotFind(const byte targetIP[], const unsigned int port) {
+  for (byte queueStep = 0; queueStep < queueSize; queueStep++) {
+    const byte queueSlot = queueIndex[queueStep];
+    if ((flagsQueue[queueSlot] & queueFlagAck) && portQueue[queueSlot] == port && IPqueue[queueSlot][0] == targetIP[0] && IPqueue[queueSlot][1] == targetIP[1] && IPqueue[queueSlot][2] == targetIP[2] && IPqueue[queueSlot][3] == targetIP[3]) {
+      return queueSlot;
+    }
+  }
+  return -1;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackPiggybackSlot - returns the queue slot of the ACK to send along with the event in queueSlot or -1 if there is none
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int8_t EtherEventQueueClass::ackPiggybackSlot(const byte queueSlot, const unsigned int payloadLength) {
+  if (!ackPiggyback || (flagsQueue[queueSlot] & queueFlagAck)) {
+    return -1;
+  }
+  const int8_t ackSlot = ackSlotFind(IPqueue[queueSlot], portQueue[queueSlot]);
+  if (ackSlot < 0 || payloadLength + strlen(payloadQueue[ackSlot]) + 2 > sendPayloadLengthMax) {  //the receiver's payload buffer is assumed to be the same size as sendPayloadLengthMax so the acks must not cause the payload to be truncated
+    return -1;
+  }
+  Serial.print(F("EtherEventQueue.ackPiggybackSlot: ackSlot="));
+  Serial.println(ackSlot);
+  return ackSlot;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackPiggybackSent - remove an ACK that was sent along with another event from the queue
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::ackPiggybackSent(const byte ackSlot) {
+  if (!(flagsQueue[ackSlot] & queueFlagAttempted) && queueNewCount > 0) {  //the ack is still counted as a new event
+    queueNewCount--;
+  }
+  remove(ackSlot);
+  stats.ackPiggybacked++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackAppend - add eventID to the ACK payload in the ackList queue buffer. Returns false if there is no room for it.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::ackAppend(char ackList[], const byte eventID) {
+  byte ackBits[ackBitsLength];
+  ackBitsRead(ackList, ackBits);
+  const byte bitIndex = eventID - 10;
+  if (ackBits[bitIndex >> 3] & (1 << (bitIndex & 7))) {  //the eventID is already pending
+    return true;
+  }
+  ackBits[bitIndex >> 3] |= 1 << (bitIndex & 7);
+  if (ackList[0] != compactMarker) {  //list
+    const unsigned int length = strlen(ackList);
+    if (length + 1 + eventIDlength <= sendPayloadLengthMax && (length + 1 + eventIDlength <= ackBitmapLength || sendPayloadLengthMax < ackBitmapLength)) {  //the list is still shorter than the bitmap
+      ackList[length] = ',';
+      itoa(eventID, ackList + length + 1, 10);
+      return true;
+    }
+    if (sendPayloadLengthMax < ackBitmapLength) {  //no room
+      return false;
+    }
+  }
+  ackBitsWrite(ackList, ackBits);
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackBitsRead - convert an ACK payload to a bit for each eventID. The payload is either a list of eventIDs or the bitmap written by ackBitsWrite(). A single eventID is a list.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::ackBitsRead(const char ackList[], byte ackBits[]) {
+  memset(ackBits, 0, ackBitsLength);
+  if (ackList[0] == compactMarker) {  //bitmap
+    if (ackList[1] != ackBitmapTag) {
+      return;
+    }
+    for (byte digit = 0; digit < ackBitmapDigitCount && ackList[digit + 2] != 0; digit++) {
+      const byte digitBits = ackList[digit + 2] - '0';
+      for (byte bit = 0; bit < 6; bit++) {
+        if (digitBits & (1 << bit)) {
+          const byte bitIndex = digit * 6 + bit;
+          ackBits[bitIndex >> 3] |= 1 << (bitIndex & 7);
+        }
+      }
+    }
+    return;
+  }
+  for (const char* eventIDchar = ackList; eventIDchar[0] != 0 && eventIDchar[1] != 0; eventIDchar++) {  //list, the separators are skipped
+    const byte eventID = eventIDparse(eventIDchar);
+    if (eventID >= 10) {
+      const byte bitIndex = eventID - 10;
+      ackBits[bitIndex >> 3] |= 1 << (bitIndex & 7);
+      eventIDchar++;  //skip the second digit
+    }
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackBitsWrite - write the ACK bitmap to ackList. Each eventID is a bit of the 6 bit digits used by the compact encoding so the bitmap is text safe.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::ackBitsWrite(char ackList[], const byte ackBits[]) {
+  ackList[0] = compactMarker;
+  ackList[1] = ackBitmapTag;
+  for (byte digit = 0; digit < ackBitmapDigitCount; digit++) {
+    byte digitBits = 0;
+    for (byte bit = 0; bit < 6; bit++) {
+      const byte bitIndex = digit * 6 + bit;
+      if (ackBits[bitIndex >> 3] & (1 << (bitIndex & 7))) {
+        digitBits |= 1 << bit;
+      }
+    }
+    ackList[digit + 2] = '0' + digitBits;
+  }
+  ackList[ackBitmapLength] = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackProcess - remove the eventTypeConfirm events acknowledged by a received ACK payload from the queue in a single pass
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::ackProcess(const char ackList[], const int senderNode) {
+  byte ackBits[ackBitsLength];
+  ackBitsRead(ackList, ackBits);
+  for (int8_t queueStep = queueSize - 1; queueStep >= 0; queueStep--) {  //newest to oldest so removing an event doesn't move the events that haven't been checked yet
+    const byte queueSlot = queueIndex[queueStep];
+    const byte eventID = (flagsQueue[queueSlot] & queueFlagMulticast) && senderNode >= 0 ? multicastEventID[queueSlot * nodeCount + senderNode] : eventIDqueue[queueSlot];  //each destination of a multicast event has its own eventID
+    const byte bitIndex = eventID - 10;
+    if (eventTypeQueue[queueSlot] == eventTypeConfirm && eventID >= 10 && (ackBits[bitIndex >> 3] & (1 << (bitIndex & 7)))) {  //the ack is for the eventID of this item in the queue and the event is expecting an ack(other events are not removed because if they're still in the queue they haven't been sent yet so the ack can't possibly be for them)
+      if (flagsQueue[queueSlot] & queueFlagMulticast) {  //only the destination that sent the ack is done
+        byte* mask = multicastMask + queueSlot * multicastMaskLength();
+        if (senderNode < 0 || !(mask[senderNode >> 3] & (1 << (senderNode & 7)))) {  //not a pending destination
+          continue;
+        }
+        Serial.print(F("EtherEventQueue.ackProcess: multicast ack from node="));
+        Serial.println(senderNode);
+        ackBits[bitIndex >> 3] &= ~(1 << (bitIndex & 7));
+        latencyHistogramRecord(latencyHistogramAck, queueSlot);
+        stats.ackMatched++;
+        mask[senderNode >> 3] &= ~(1 << (senderNode & 7));
+        byte counter;
+        for (counter = 0; counter < multicastMaskLength() && mask[counter] == 0; counter++) {}
+        if (counter == multicastMaskLength()) {  //all destinations have acked
+          remove(queueSlot);
+        }
+        continue;
+      }
+      Serial.print(F("EtherEventQueue.ackProcess: ack eventID match="));
+      Serial.println(eventIDqueue[queueSlot]);
+      ackBits[bitIndex >> 3] &= ~(1 << (bitIndex & 7));  //each eventID is only used by one event in the queue
+      latencyHistogramRecord(latencyHistogramAck, queueSlot);
+      sendWindowAck(queueSlot);
+      remove(queueSlot);  //remove the message from the queue
+      stats.ackMatched++;
+    }
+  }
+  for (byte bitIndex = 0; bitIndex < 90; bitIndex++) {
+    if (ackBits[bitIndex >> 3] & (1 << (bitIndex & 7))) {
+      stats.ackUnmatched++;
+    }
+  }
+  if (queueNewCount > queueSize) {  //sanity check - if the ack incorrectly has the eventID of a new queue item then the queueNewCount value will be greater than the number of new queue items
+    queueNewCount = queueSize;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//ackPiggybackReceive - process the ACKs at the start of a received raw payload. Returns the length of the ACK block to skip.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+unsigned int EtherEventQueueClass::ackPiggybackReceive(char ackBlock[], const int senderNode) {
+  char* ackBlockEnd = strchr(ackBlock + 1, ackMarker);
+  if (ackBlockEnd == NULL) {  //the payload was truncated so the acks are incomplete
+    Serial.println(F("EtherEventQueue.ackPiggybackReceive: truncated"));
+    return strlen(ackBlock);
+  }
+  *ackBlockEnd = 0;
+  Serial.print(F("EtherEventQueue.ackPiggybackReceive: acks="));
+  Serial.println(ackBlock + 1);
+  ackProcess(ackBlock + 1, senderNode);
+  return ackBlockEnd - ackBlock + 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//duplicateCheck - returns true if eventID was recently received from the node, otherwise it's added to the node's duplicate window. Duplicates are acknowledged again because the previous ACK might have been lost.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::duplicateCheck(const unsigned int node, const byte eventID) {
+  byte* window = duplicateWindow + node * ackBitsLength;
+  const unsigned long timestamp = clockMillis();
+  if (timestamp - duplicateTimestamp[node] > duplicateWindowDuration) {  //no new event was received from the node for longer than it retransmits, e.g. it was reset, so the eventIDs in the window are stale
+    memset(window, 0, ackBitsLength);
+  }
+  const byte bitIndex = eventID - 10;
+  if (window[bitIndex >> 3] & (1 << (bitIndex & 7))) {
+    Serial.print(F("EtherEventQueue.duplicateCheck: duplicate eventID="));
+    Serial.println(eventID);
+    stats.duplicateDropped++;
+    if (eventAck != NULL) {
+      queueAck(node, duplicateAckPort, eventID);
+    }
+    return true;
+  }
+  //the sender assigns eventIDs in rotation so the eventIDs after this one were received during the previous rotation, clear them so they are received as new events when the rotation wraps
+  for (byte count = 1; count <= duplicateClearLength; count++) {
+    const byte clearIndex = bitIndex + count < 90 ? bitIndex + count : bitIndex + count - 90;
+    window[clearIndex >> 3] &= ~(1 << (clearIndex & 7));
+  }
+  window[bitIndex >> 3] |= 1 << (bitIndex & 7);
+  duplicateTimestamp[node] = timestamp;
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendWindowReset - set the send window of all nodes to the initial size with no events waiting for an ACK
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendWindowReset() {
+  sendWindowBlockedCount = 0;
+  if (nodeWindow == NULL) {
+    return;
+  }
+  for (unsigned int node = 0; node < nodeCount; node++) {
+    nodeWindow[node].inFlight = 0;
+    nodeWindow[node].size = sendWindowAdaptive ? 1 : sendWindowSize;  //the adaptive window starts small and grows as ACKs arrive
+    nodeWindow[node].ackCount = 0;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendWindowAck - additive increase: the adaptive window of the target node of the ACKed event grows by one event after a full window of ACKs
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendWindowAck(const byte queueSlot) {
+  if (nodeWindow == NULL || !sendWindowAdaptive) {
+    return;
+  }
+  const int node = getNode(IPqueue[queueSlot]);
+  if (node < 0) {
+    return;
+  }
+  nodeWindow[node].ackCount++;
+  if (nodeWindow[node].ackCount >= nodeWindow[node].size && nodeWindow[node].size < sendWindowSize) {
+    nodeWindow[node].size++;
+    nodeWindow[node].ackCount = 0;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendWindowLoss - multiplicative decrease: the adaptive window is halved when an event that was sent has to be resent because its ACK didn't arrive. Resends are at least resendDelay apart so the window is halved at most once per resendDelay.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendWindowLoss(const unsigned int node, const byte queueSlot) {
+  if (nodeWindow == NULL || !sendWindowAdaptive || eventTypeQueue[queueSlot] != eventTypeConfirm || (flagsQueue[queueSlot] & queueFlagMulticast)) {  //multicast events are not limited by the send window
+    return;
+  }
+  nodeWindow[node].size = max(nodeWindow[node].size / 2, 1);
+  nodeWindow[node].ackCount = 0;
+  Serial.print(F("EtherEventQueue.sendWindowLoss: size="));
+  Serial.println(nodeWindow[node].size);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendWindowRemove - an event that was waiting for an ACK is being removed from the queue so it no longer counts against the window
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::sendWindowRemove(const byte queueSlot) {
+  if (nodeWindow == NULL || eventTypeQueue[queueSlot] != eventTypeConfirm || (flagsQueue[queueSlot] & (queueFlagSent | queueFlagMulticast)) != queueFlagSent) {
+    return;
+  }
+  const int node = getNode(IPqueue[queueSlot]);
+  if (node >= 0 && nodeWindow[node].inFlight > 0) {
+    nodeWindow[node].inFlight--;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//sendWindowBlocked - returns true if the event in queueSlot is an eventTypeConfirm event that has not been sent yet and the send window of its target node is full
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::sendWindowBlocked(const byte queueSlot) {
+  if (nodeWindow == NULL || eventTypeQueue[queueSlot] != eventTypeConfirm || (flagsQueue[queueSlot] & (queueFlagSent | queueFlagMulticast))) {
+    return false;
+  }
+  const int node = getNode(IPqueue[queueSlot]);
+  return node >= 0 && nodeWindow[node].inFlight >= nodeWindow[node].size;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//newEventTake - the new event at position in the queueIndex is being sent so it is no longer counted as new. It is moved in front of the new events held back by the send window, which stay new and in order.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::newEventTake(const byte position) {
+  const byte newPosition = queueSize - queueNewCount;
+  const int8_t queueSlot = queueIndex[position];
+  for (byte counter = position; counter > newPosition; counter--) {
+    queueIndex[counter] = queueIndex[counter - 1];
+  }
+  queueIndex[newPosition] = queueSlot;
+  queueNewCount--;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//multicastNext - move a multicast event on to its next pending destination, optionally removing the current one from the pending destinations first. The event is removed from the queue when no destinations are left.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::multicastNext(const byte queueSlot, const boolean destinationDone) {
+  byte* mask = multicastMask + queueSlot * multicastMaskLength();
+  const int node = getNode(IPqueue[queueSlot]);
+  if (destinationDone && node >= 0) {
+    mask[node >> 3] &= ~(1 << (node & 7));
+  }
+  int nextNode = -1;
+  for (unsigned int counter = 1; counter <= nodeCount; counter++) {  //search from the node after the current destination and wrap around
+    const unsigned int candidate = (node + counter) % nodeCount;
+    if (mask[candidate >> 3] & (1 << (candidate & 7))) {
+      nextNode = candidate;
+      break;
+    }
+  }
+  if (nextNode < 0) {  //all destinations are done
+    Serial.println(F("EtherEventQueue.multicastNext: done"));
+    remove(queueSlot);
+    return;
+  }
+  Serial.print(F("EtherEventQueue.multicastNext: nextNode="));
+  Serial.println(nextNode);
+  IPcopy(IPqueue[queueSlot], nodeIP[nextNode]);
+  byte &destinationEventID = multicastEventID[queueSlot * nodeCount + nextNode];
+  if ((flagsQueue[queueSlot] & queueFlagMulticastResend) || nextNode <= node) {  //a resend uses the eventID the destination received before so its duplicate window recognizes it
+    eventIDqueue[queueSlot] = destinationEventID;
+    if (nextNode <= node) {  //wrapped around so every destination has been attempted
+      flagsQueue[queueSlot] |= queueFlagMulticastResend | queueFlagAttempted | queueFlagSent;
+    }
+    return;
+  }
+  eventIDqueue[queueSlot] = 0;  //the previous destination's eventID stays in use through multicastEventID
+  destinationEventID = eventIDfind(nextNode);  //each destination gets the next eventID of its own rotation
+  eventIDqueue[queueSlot] = destinationEventID;
+
+  //the first attempt to the next destination is a new event so it is moved to the end of the queue and is sent after the events that were queued since
+  flagsQueue[queueSlot] &= ~(queueFlagAttempted | queueFlagSent);
+  byte position;
+  for (position = 0; position < queueSize - 1 && queueIndex[position] != queueSlot; position++) {}
+  for (; position < queueSize - 1; position++) {
+    queueIndex[position] = queueIndex[position + 1];
+  }
+  queueIndex[queueSize - 1] = queueSlot;
+  if (queueNewCount < queueSize) {  //sanity check
+    queueNewCount++;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//circuitFind - returns the circuit breaker of the target or NULL if failures to it are not being tracked
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+EtherEventQueueClass::circuit_t* EtherEventQueueClass::circuitFind(const byte IP[], const unsigned int port) {
+  for (byte counter = 0; counter < circuitBreakerCount; counter++) {
+    circuit_t &circuit = circuitBreaker[counter];
+    if (circuit.failures > 0 && circuit.port == port && circuit.IP[0] == IP[0] && circuit.IP[1] == IP[1] && circuit.IP[2] == IP[2] && circuit.IP[3] == IP[3]) {
+      return &circuit;
+    }
+  }
+  return NULL;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//circuitState - returns the state of the circuit breaker of the target. An open breaker becomes half-open when openDuration has passed so the next event to the target is sent as a probe.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+byte EtherEventQueueClass::circuitState(const byte IP[], const unsigned int port) {
+  const circuit_t* circuit = circuitFind(IP, port);
+  if (circuit == NULL || !circuit->open) {
+    return circuitClosed;
+  }
+  if (clockMillis() - circuit->openTimestamp < circuitOpenDuration) {
+    return circuitOpen;
+  }
+  return circuitHalfOpen;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//circuitSendResult - update the circuit breaker of the target with the result of a send
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::circuitSendResult(const byte IP[], const unsigned int port, const boolean sendSuccess) {
+  circuit_t* circuit = circuitFind(IP, port);
+  if (sendSuccess) {
+    if (circuit != NULL) {  //close the breaker
+      circuit->failures = 0;
+      circuit->open = false;
+    }
+    return;
+  }
+  if (circuit == NULL) {  //start tracking the target in an unused breaker or the closed breaker with the fewest failures
+    for (byte counter = 0; counter < circuitBreakerCount; counter++) {
+      if (!circuitBreaker[counter].open && (circuit == NULL || circuitBreaker[counter].failures < circuit->failures)) {
+        circuit = &circuitBreaker[counter];
+      }
+    }
+    if (circuit == NULL) {  //all breakers are open
+      return;
+    }
+    for (byte counter = 0; counter < 4; counter++) {
+      circuit->IP[counter] = IP[counter];
+    }
+    circuit->port = port;
+    circuit->failures = 0;
+  }
+  if (circuit->failures < 255) {
+    circuit->failures++;
+  }
+  if (circuit->open || circuit->failures >= circuitFailureThreshold) {  //failed probe or too many failures
+    if (!circuit->open) {
+      Serial.println(F("EtherEventQueue.circuitSendResult: circuit opened"));
+      stats.circuitOpened++;
+    }
+    circuit->open = true;
+    circuit->openTimestamp = clockMillis();  //skip the target for another openDuration
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveBufferWrite - append length bytes to the receive buffer, wrapping around at the end
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receiveBufferWrite(const byte data[], const unsigned int length) {
+  unsigned int position = receiveBufferHead + receiveBufferUsed;
+  if (position >= receiveBufferSize) {
+    position -= receiveBufferSize;
+  }
+  const unsigned int lengthToEnd = min(length, receiveBufferSize - position);
+  memcpy(receiveBuffer + position, data, lengthToEnd);
+  memcpy(receiveBuffer, data + lengthToEnd, length - lengthToEnd);
+  receiveBufferUsed += length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveBufferRead - remove length bytes from the start of the receive buffer, wrapping around at the end
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receiveBufferRead(byte data[], const unsigned int length) {
+  const unsigned int lengthToEnd = min(length, receiveBufferSize - receiveBufferHead);
+  memcpy(data, receiveBuffer + receiveBufferHead, lengthToEnd);
+  memcpy(data + lengthToEnd, receiveBuffer, length - lengthToEnd);
+  receiveBufferHead += length;
+  if (receiveBufferHead >= receiveBufferSize) {
+    receiveBufferHead -= receiveBufferSize;
+  }
+  receiveBufferUsed -= length;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveBufferPush - add a received event to the receive buffer. availableEvent() only calls this when there is space for receiveBufferRecordLengthMax() bytes.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receiveBufferPush(const byte eventID, const char event[], const char payload[]) {
+  const byte eventLength = strlen(event);
+  const unsigned int payloadLength = strlen(payload);
+  const byte header[receiveBufferHeaderLength] = {eventID, eventLength, (byte)(payloadLength & 0xFF), (byte)(payloadLength >> 8)};
+  receiveBufferWrite(header, receiveBufferHeaderLength);
+  receiveBufferWrite((const byte*)event, eventLength);
+  receiveBufferWrite((const byte*)payload, payloadLength);
+  receiveBufferCount++;
+  Serial.print(F("EtherEventQueue.receiveBufferPush: receiveBufferCount="));
+  Serial.println(receiveBufferCount);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveBufferPop - move the oldest event in the receive buffer to the received event buffers
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receiveBufferPop() {
+  byte header[receiveBufferHeaderLength];
+  receiveBufferRead(header, receiveBufferHeaderLength);
+  receivedEventIDvalue = header[0];
+  receiveBufferRead((byte*)receivedEvent, header[1]);
+  receivedEvent[header[1]] = 0;
+  const unsigned int payloadLength = header[2] | (header[3] << 8);
+  receiveBufferRead((byte*)receivedPayload, payloadLength);
+  receivedPayload[payloadLength] = 0;
+  receiveBufferCount--;
+  receivedPayloadDecode();
+  receivedEventLength = header[1] + 1;  //length of the event + null terminator
+  Serial.print(F("EtherEventQueue.receiveBufferPop: event="));
+  Serial.println(receivedEvent);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//receiveReadEvent, receiveAvailablePayload, receiveReadPayload, receiveFlush - read the received event from the network set by setNetwork() or from EtherEvent
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void EtherEventQueueClass::receiveReadEvent(char eventBuffer[]) {
+  if (network != NULL) {
+    network->readEvent(eventBuffer);
+  }
+  else {
+    EtherEvent.readEvent(eventBuffer);
+  }
+}
+
+
+unsigned int EtherEventQueueClass::receiveAvailablePayload() {
+  return network != NULL ? network->availablePayload() : EtherEvent.availablePayload();
+}
+
+
+void EtherEventQueueClass::receiveReadPayload(char payloadBuffer[]) {
+  if (network != NULL) {
+    network->readPayload(payloadBuffer);
+  }
+  else {
+    EtherEvent.readPayload(payloadBuffer);
+  }
+}
+
+
+void EtherEventQueueClass::receiveFlush() {
+  if (network != NULL) {
+    network->flushReceiver();
+  }
+  else {
+    EtherEvent.flushReceiver();
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//networkSend - send the event in queueSlot through the network set by setNetwork(). F() events are copied to SRAM first because the network only accepts strings.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+boolean EtherEventQueueClass::networkSend(const byte queueSlot, const char payload[]) {
+  const boolean eventFlash = flagsQueue[queueSlot] & queueFlagEventFlash;
+  char event[queueStringLength(eventQueue[queueSlot], eventFlash) + 1];
+  queueStringCopy(event, eventQueue[queueSlot], eventFlash, sizeof(event) - 1);
+  return network->send(IPqueue[queueSlot], portQueue[queueSlot], event, payload) > 0;
+}
+
 EtherEventQueueClass EtherEventQueue;  //This sets up a single global instance of the library so the class doesn't need to be declared in the user sketch and multiple instances are not necessary in this case.
 
@@ -16,6 +16,38 @@
 #if ETHEREVENTQUEUE_DEBUG == true
 #pragma message "EtherEventQueue debug output enabled"
 #endif  //ETHEREVENTQUEUE_DEBUG == true
+//the staging queue indexes are read and written with acquire/release ordering so a staged record is complete before the other side sees the index that makes it visible. On single core AVR this only keeps the compiler from reordering the memory accesses.
+#define ETHEREVENTQUEUE_STAGING_GET(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define ETHEREVENTQUEUE_STAGING_SET(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//EtherEventQueueStorage - interface for the persistent storage used by EtherEventQueue.setStorage(). Inherit from this class to add a new storage medium, see EtherEventQueueEEPROM.h for an example.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class EtherEventQueueStorage {
+  public:
+    virtual unsigned int length() = 0;  //number of bytes of storage
+    virtual byte read(const unsigned int address) = 0;
+    virtual void write(const unsigned int address, const byte value) = 0;
+    virtual void commit() {}  //called after each record is written or consumed so that buffered media(flash page, SD file) can write the changes in one batch
+};
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//EtherEventQueueNetwork - interface for sending and receiving events through something other than EtherEvent, used by EtherEventQueue.setNetwork(). The functions have the same meaning as the EtherEvent functions of the same name. See the Simulation example.
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+class EtherEventQueueNetwork {
+  public:
+    virtual byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) = 0;  //returns 0 on failure
+    virtual byte availableEvent() = 0;  //returns the number of bytes of the received event or 0 if there is none
+    virtual void readEvent(char eventBuffer[]) = 0;
+    virtual unsigned int availablePayload() = 0;
+    virtual void readPayload(char payloadBuffer[]) = 0;
+    virtual void flushReceiver() = 0;
+    virtual IPAddress senderIP() {
+      return IPAddress(0, 0, 0, 0);
+    }
+};
 
 
 class EtherEventQueueClass {
@@ -28,12 +60,208 @@ class EtherEventQueueClass {
 
     static const byte queueSuccessOverflow = 2;
 
+    //circuit breaker states - see getCircuitState()
+    static const byte circuitClosed = 0;  //events are sent normally
+    static const byte circuitOpen = 1;  //sends to the target have failed repeatedly so its events are skipped
+    static const byte circuitHalfOpen = 2;  //the next send to the target is a probe that closes the circuit if it succeeds
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //value_t - event or payload of any of the supported types. The value is stored as passed and converted to a string by queue() directly into the queue slot so no intermediate buffers are needed.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    class value_t {
+      public:
+        static const byte typeString = 0;
+        static const byte typeFlashString = 1;
+        static const byte typeSigned = 2;
+        static const byte typeUnsigned = 3;
+        static const byte typeDouble = 4;
+        static const byte typeIPAddress = 5;
+        static const byte typeCompactFlag = 0x80;  //set in type by EtherEventQueue.compact()
+
+        value_t() {
+          type = typeString;
+          data.string = "";
+        }
+        value_t(const char string[]) {
+          type = typeString;
+          data.string = string;
+        }
+        value_t(const __FlashStringHelper* flashString) {
+          type = typeFlashString;
+          data.flashString = flashString;
+        }
+        value_t(const String &string) {  //the String must exist until queue() returns
+          type = typeString;
+          data.string = string.c_str();
+        }
+        value_t(const signed char number) {
+          setSigned(number);
+        }
+        value_t(const unsigned char number) {
+          setUnsigned(number);
+        }
+        value_t(const short number) {
+          setSigned(number);
+        }
+        value_t(const unsigned short number) {
+          setUnsigned(number);
+        }
+        value_t(const int number) {
+          setSigned(number);
+        }
+        value_t(const unsigned int number) {
+          setUnsigned(number);
+        }
+        value_t(const long number) {
+          setSigned(number);
+        }
+        value_t(const unsigned long number) {
+          setUnsigned(number);
+        }
+        value_t(const double number) {
+          type = typeDouble;
+          data.doubleValue = number;
+        }
+        value_t(const IPAddress &IP) {
+          type = typeIPAddress;
+          for (byte counter = 0; counter < 4; counter++) {
+            data.IP[counter] = IP[counter];
+          }
+        }
+
+        unsigned int write(char buffer[], const unsigned int lengthMax, const byte decimalPlaces) const;
+        unsigned int writeCompact(char buffer[], const unsigned int lengthMax) const;
+        boolean readCompact(const char buffer[]);
+
+        byte type;
+        union {
+          const char* string;
+          const __FlashStringHelper* flashString;
+          long signedValue;
+          unsigned long unsignedValue;
+          double doubleValue;
+          byte IP[4];
+        } data;
+
+      private:
+        void setSigned(const long number) {
+          type = typeSigned;
+          data.signedValue = number;
+        }
+        void setUnsigned(const unsigned long number) {
+          type = typeUnsigned;
+          data.unsignedValue = number;
+        }
+
+        static unsigned int writeDigits(char buffer[], const unsigned int lengthMax, unsigned long number, byte digitCount);
+        static unsigned int writeUnsigned(char buffer[], const unsigned int lengthMax, const unsigned long number);
+        static unsigned int writeDouble(char buffer[], const unsigned int lengthMax, double number, byte decimalPlaces);
+    };
+
+    //latency histograms - see getLatencyHistogram()
+    static const byte latencyHistogramAttempt = 0;  //queue() to first send attempt
+    static const byte latencyHistogramSend = 1;  //queue() to first successful send
+    static const byte latencyHistogramAck = 2;  //queue() to removal by ACK(eventTypeConfirm only)
+    static const byte latencyHistogramCount = 3;
+    static const byte latencyHistogramBucketCount = 20;  //bucket 0 is 0 ms, bucket n is 2^(n-1) to 2^n - 1 ms, the last bucket also holds all longer latencies
+
+    //statistics counters - see getStats()
+    struct stats_t {
+      unsigned long enqueued;  //events successfully queued
+      unsigned long sent;  //successful sends
+      unsigned long sendFailed;  //failed sends
+      unsigned long resent;  //sends of events that had already been sent or attempted before
+      unsigned long ackMatched;  //events removed from the queue by received ACKs
+      unsigned long ackUnmatched;  //eventIDs in received ACKs with no matching event in the queue
+      unsigned long overflowed;  //events removed from the queue because of queue overflow
+      unsigned long expired;  //eventTypeOnce and eventTypeOverrideTimeout events removed after a failed send
+      unsigned long timedOutDropped;  //events removed from the queue because the target node timed out
+      unsigned long keepaliveSent;  //keepalives queued by sendKeepalive()
+      unsigned long keepaliveReceived;
+      unsigned long spilled;  //events written to the persistent storage because the queue was full
+      unsigned long ackPiggybacked;  //ACKs sent along with another event instead of separately
+      unsigned long duplicateDropped;  //retransmitted events dropped by the duplicate window
+      unsigned long circuitOpened;  //times a circuit breaker opened
+      unsigned long compressionSaved;  //payload bytes saved by compression
+      unsigned long rateLimitDeferred;  //events held back by a rate limit
+      unsigned long rateLimitDropped;  //events removed from the queue by a rate limit
+      byte queueSizeHighWater;  //largest number of events that have been in the queue at one time
+    };
+
+    //per node statistics - see getNodeStats()
+    struct nodeStats_t {
+      unsigned long sendCount;  //successful sends to the node
+      unsigned long sendFailedCount;  //failed sends to the node
+      unsigned long receiveCount;  //events received from the node(only available with the modified Ethernet library)
+      unsigned long sendLatencyMin;  //(us)shortest duration of EtherEvent.send()
+      unsigned long sendLatencyMax;  //(us)longest duration of EtherEvent.send()
+      unsigned long sendLatencyTotal;  //(us)total duration of all EtherEvent.send() calls, used to calculate the average
+      unsigned long sendLatencyAverage() const {
+        const unsigned long sendTotalCount = sendCount + sendFailedCount;
+        return sendTotalCount > 0 ? sendLatencyTotal / sendTotalCount : 0;
+      }
+    };
+
+    //event of a batch queued by queue(records, recordCount, results), also used for the records of the staging queue
+    struct queueRecord_t {
+      int targetNode;  //-1 when the target is targetIP
+      byte targetIP[4];
+      unsigned int port;
+      byte eventType;
+      value_t event;
+      value_t payload;
+    };
+
+    //view of an event in the queue - see entries(). The pointers point into the queue buffers so a view is only valid until the queue is changed.
+    struct entry_t {
+      const byte* IP;  //the target IP address, the current destination of a queueMulticast() event
+      unsigned int port;
+      const char* event;  //points to program memory if eventFlash is true
+      boolean eventFlash;  //the event was queued as an F() string
+      const char* payload;  //as stored in the queue, compact encoded and compressed payloads are not decoded. Points to program memory if payloadFlash is true
+      boolean payloadFlash;  //the payload was queued as an F() string
+      byte eventID;
+      byte eventType;
+      unsigned long age;  //(ms)time since the event was queued
+    };
+
+    //iterator over the events in the queue from the oldest to the newest, which is the order they are sent in - see entries()
+    class entryIterator_t {
+      public:
+        entryIterator_t(const EtherEventQueueClass &queueInput, const byte positionInput) : queue(queueInput), position(positionInput) {}
+        entry_t operator*() const {
+          return queue.entryGet(queue.queueIndex[position]);
+        }
+        entryIterator_t& operator++() {
+          position++;
+          return *this;
+        }
+        boolean operator!=(const entryIterator_t &other) const {
+          return position != other.position;
+        }
+      private:
+        const EtherEventQueueClass &queue;
+        byte position;  //queueIndex position
+    };
+
+    //the events in the queue for a range-based for loop - see entries()
+    struct entryRange_t {
+      entryIterator_t first;
+      entryIterator_t last;
+      entryIterator_t begin() const {
+        return first;
+      }
+      entryIterator_t end() const {
+        return last;
+      }
+    };
+
     EtherEventQueueClass();
 
     boolean begin();
     boolean begin(const byte queueSizeMaxInput, const byte sendEventLengthMaxInput, const unsigned int sendPayloadLengthMaxInput, const byte receivedEventLengthMaxInput, const unsigned int receivedPayloadLengthMaxInput);
-    boolean begin(const byte nodeDeviceInput, const byte nodeCountInput);
-    boolean begin(const byte nodeDeviceInput, byte nodeCountInput, byte queueSizeMaxInput, const byte sendEventLengthMaxInput, const unsigned int sendPayloadLengthMaxInput, const byte receivedEventLengthMaxInput, const unsigned int receivedPayloadLengthMaxInput);
+    boolean begin(const unsigned int nodeDeviceInput, const unsigned int nodeCountInput);
+    boolean begin(const unsigned int nodeDeviceInput, unsigned int nodeCountInput, byte queueSizeMaxInput, const byte sendEventLengthMaxInput, const unsigned int sendPayloadLengthMaxInput, const byte receivedEventLengthMaxInput, const unsigned int receivedPayloadLengthMaxInput);
 
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -43,114 +271,78 @@ class EtherEventQueueClass {
     byte availableEvent(EthernetServer &ethernetServer, long cookieInput = false) {
 #else
     byte availableEvent(EthernetServer &ethernetServer) {
+      const long cookieInput = false;  //not used when authentication is disabled
 #endif
       if (receivedEventLength == 0) {  //there is no event buffered
         if (internalEventQueueCount > 0) {
-          for (int8_t queueStepCount = queueSize - 1; queueStepCount >= 0; queueStepCount--) {  //internal event system: step through the queue from the newest to oldest
-            if (IPqueue[queueStepCount][0] == nodeIP[nodeDevice][0] && IPqueue[queueStepCount][1] == nodeIP[nodeDevice][1] && IPqueue[queueStepCount][2] == nodeIP[nodeDevice][2] && IPqueue[queueStepCount][3] == nodeIP[nodeDevice][3]) {  //internal event
-              strcpy(receivedEvent, eventQueue[queueStepCount]);
+          const unsigned long workTimestamp = micros();
+          if (!workBudgetEnabled() || internalEventStep < 0 || internalEventStep >= queueSize) {  //start from the newest event unless an interrupted search is resumed
+            internalEventStep = queueSize - 1;
+          }
+          for (byte counter = 0; counter < queueSize; counter++) {  //internal event system: step through the queue from the newest to oldest
+            if (counter > 0 && workBudgetExhausted(counter, workTimestamp)) {  //the search is resumed from internalEventStep on the next call
+              break;
+            }
+            const byte queuePosition = internalEventStep;
+            const byte queueSlot = queueIndex[queuePosition];
+            internalEventStep = internalEventStep > 0 ? internalEventStep - 1 : queueSize - 1;
+            if (IPqueue[queueSlot][0] == nodeIP[nodeDevice][0] && IPqueue[queueSlot][1] == nodeIP[nodeDevice][1] && IPqueue[queueSlot][2] == nodeIP[nodeDevice][2] && IPqueue[queueSlot][3] == nodeIP[nodeDevice][3]) {  //internal event
+              queueStringCopy(receivedEvent, eventQueue[queueSlot], flagsQueue[queueSlot] & queueFlagEventFlash, receivedEventLengthMax);
               ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: internal event="));
               ETHEREVENTQUEUE_SERIAL.println(receivedEvent);
-              strcpy(receivedPayload, payloadQueue[queueStepCount]);
+              queueStringCopy(receivedPayload, payloadQueue[queueSlot], flagsQueue[queueSlot] & queueFlagPayloadFlash, receivedPayloadLengthMax);
+              receivedPayloadDecode();
               ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: internal event payload="));
               ETHEREVENTQUEUE_SERIAL.println(receivedPayload);
-              remove(queueStepCount);  //remove the event from the queue
-              queueNewCount--;  //queueHandler doesn't handle internal events so they will always be new events
+              if (queuePosition >= queueSize - queueNewCount) {  //queueHandler skips internal events but an internal event it has stepped over is no longer counted as new
+                queueNewCount--;
+              }
+              remove(queueSlot);  //remove the event from the queue
+              internalEventStep = -1;  //the next search starts from the newest event
               return strlen(receivedEvent);
             }
           }
         }
+      }
 
-#ifndef ETHEREVENT_NO_AUTHENTICATION
-        if (const byte availableBytesEvent = EtherEvent.availableEvent(ethernetServer, cookieInput)) {  //there is a new event
-#else  //ETHEREVENT_NO_AUTHENTICATION
-        if (const byte availableBytesEvent = EtherEvent.availableEvent(ethernetServer)) {  //there is a new event
-#endif  //ETHEREVENT_NO_AUTHENTICATION
-          ETHEREVENTQUEUE_SERIAL.println(F("---------------------------"));
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: EtherEvent.availableEvent()="));
-          ETHEREVENTQUEUE_SERIAL.println(availableBytesEvent);
-#ifdef ethernetclientwithremoteIP_h  //this function is only available if the modified Ethernet library is installed
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: remoteIP="));
-          ETHEREVENTQUEUE_SERIAL.println(EtherEvent.senderIP());
-#endif  //ethernetclientwithremoteIP_h
-
-          nodeTimestamp[nodeDevice] = millis();  //set the device timestamp(using the nodeDevice because that part of the array is never used otherwise)
-#ifdef ethernetclientwithremoteIP_h  //this function is only available if the modified Ethernet library is installed
-          //update timestamp of the event sender
-          const int8_t senderNode = getNode(EtherEvent.senderIP());  //get the node of the senderIP
-          if (senderNode >= 0) {  //receivedIP is a node(-1 indicates no node match)
-            nodeTimestamp[senderNode] = nodeTimestamp[nodeDevice];  //set the individual timestamp, any communication is considered to be a received keepalive - the nodeTimestamp for the device has just been set so I am using that variable so I don't have to call millis() twice for efficiency
-            sendKeepaliveTimestamp[senderNode] = nodeTimestamp[nodeDevice] - sendKeepaliveResendDelay;  //Treat successful receive of any event as a sent keepalive so delay the send of the next keepalive. -sendKeepaliveResendDelay is so that sendKeepalive() will be able to queue the eventKeepalive according to "millis() - nodeTimestamp[node] > nodeTimeoutDuration - sendKeepaliveMargin" without being blocked by the "millis() - sendKeepaliveTimestamp[node] > sendKeepaliveResendDelay", it will not cause immediate queue of eventKeepalive because nodeTimestamp[targetNode] has just been set. The nodeTimestamp for the device has just been set so I am using that variable so I don't have to call millis() again
-            if (nodeState[senderNode] == nodeStateUnknown) {
-              nodeState[senderNode] = nodeStateActive;  //set the node state to active
-            }
-          }
-          else if (receiveNodesOnlyState == 1) {  //the event was not received from a node and it is configured to receive events from node IPs only
-            ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: unauthorized IP"));
-            EtherEvent.flushReceiver();  //event has not been read yet so have to flush
-            return 0;
-          }
-#endif  //ethernetclientwithremoteIP_h
-
-          EtherEvent.readEvent(receivedEvent);  //put the event in the buffer
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: event="));
-          ETHEREVENTQUEUE_SERIAL.println(receivedEvent);
-
-          if (eventKeepalive != NULL && strcmp(receivedEvent, eventKeepalive) == 0) {  //keepalive received
-            ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: keepalive received"));
-            flushReceiver();  //the event has been read so EtherEventQueue has to be flushed
-            return 0;  //receive keepalive silently
-          }
-
-          const unsigned int payloadLength = EtherEvent.availablePayload();
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: EtherEvent.availablePayload()="));
-          ETHEREVENTQUEUE_SERIAL.println(payloadLength);
-          char receivedPayloadRaw[payloadLength];
-          EtherEvent.readPayload(receivedPayloadRaw);  //read the payload to the buffer
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: rawPayload="));
-          ETHEREVENTQUEUE_SERIAL.println(receivedPayloadRaw);
-
-          //break the payload down into parts and convert the eventID to byte, the true payload stays as a char array
-          //the first part of the raw payload is the eventID
-          char receivedEventIDchar[eventIDlength + 1];
-          for (byte count = 0; count < eventIDlength; count++) {
-            receivedEventIDchar[count] = receivedPayloadRaw[count];
-          }
-          receivedEventIDchar[eventIDlength] = 0;  //add the null terminator because there is not one after the id in the string
-          receivedEventIDvalue = atoi(receivedEventIDchar);
-          ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: eventID="));
-          ETHEREVENTQUEUE_SERIAL.println(receivedEventIDvalue);
-
-          if (payloadLength > eventIDlength + 1) {  //there is a true payload
-            for (unsigned int count = 0; count < payloadLength - eventIDlength; count++) {
-              receivedPayload[count] = receivedPayloadRaw[count + eventIDlength];
-            }
-            ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: receivedPayload="));
-            ETHEREVENTQUEUE_SERIAL.println(receivedPayload);
+      //service up to receivePollCount connections. Without the receive buffer a new event is only received after the buffered event has been read or flushed, with the receive buffer new events are accepted while there is space so the senders don't have to wait for the sketch to read the buffered event
+      const unsigned long workTimestamp = micros();
+      for (byte counter = 0; counter < receivePollCount; counter++) {
+        if (counter > 0 && workBudgetExhausted(counter, workTimestamp)) {
+          break;
+        }
+        if (receiveBuffer == NULL ? receivedEventLength > 0 : receiveBufferSize - receiveBufferUsed < receiveBufferRecordLengthMax()) {  //no space for another event
+          break;
+        }
+        const byte availableBytesEvent = receiveAvailableEvent(ethernetServer, cookieInput);
+        if (availableBytesEvent == 0) {  //no new event
+          break;
+        }
+        if (receiveBuffer == NULL) {
+          const boolean sketchEvent = receiveEvent(availableBytesEvent, receivedEvent, receivedPayload, receivedEventIDvalue);
+          receiveFlush();  //the event has been copied to the EtherEventQueue buffers or handled, so the network can accept the next connection even if a keepalive's payload was not read
+          if (sketchEvent) {
+            receivedPayloadDecode();
+            receivedEventLength = availableBytesEvent;  //there is a new event
           }
-          else {  //no true payload
-            receivedPayload[0] = 0;  //clear the payload buffer
+          else {  //the event was handled by EtherEventQueue
+            flushReceiver();
           }
-
-          if (eventAck != NULL && strcmp(receivedEvent, eventAck) == 0) {  //ack handler
-            ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: ack received"));
-            const byte receivedPayloadInt = atoi(receivedPayload);  //convert to a byte
-            for (byte count = 0; count < queueSize; count++) {  //step through the currently occupied section of the eventIDqueue[]
-              if (receivedPayloadInt == eventIDqueue[count] && eventTypeQueue[count] == eventTypeConfirm) {  //the ack is for the eventID of this item in the queue and the resend flag indicates it is expecting an ack(non-ack events are not removed because obviously they haven't been sent yet if they're still in the queue so the ack can't possibly be for them)
-                ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: ack eventID match"));
-                remove(count);  //remove the message from the queue
-                if (queueNewCount > queueSize) {  //sanity check - if the ack incorrectly has the eventID of a new queue item then the queueNewCount value will be greater than the number of new queue items
-                  queueNewCount = queueSize;
-                }
-              }
-            }
-            flushReceiver();  //event and payload have been read so only have to flush EtherEventQueue
-            return 0;  //receive ack silently
+        }
+        else {
+          char eventBuffer[receivedEventLengthMax + 1];
+          char payloadBuffer[receivedPayloadLengthMax + 1];
+          byte eventIDvalue;
+          const boolean sketchEvent = receiveEvent(availableBytesEvent, eventBuffer, payloadBuffer, eventIDvalue);
+          receiveFlush();
+          if (sketchEvent) {
+            receiveBufferPush(eventIDvalue, eventBuffer, payloadBuffer);
           }
-
-          receivedEventLength = availableBytesEvent;  //there is a new event
         }
       }
+      if (receiveBuffer != NULL && receivedEventLength == 0 && receiveBufferCount > 0) {
+        receiveBufferPop();  //the oldest buffered event becomes the received event
+      }
       return receivedEventLength;
     }
 
@@ -160,252 +352,254 @@ class EtherEventQueueClass {
     void readPayload(char payloadBuffer[]);
 
     byte receivedEventID();
+    const value_t& receivedPayloadValue();
     void flushReceiver();
+    boolean setReceiveBuffer(const unsigned int bufferSize);
+    unsigned int getReceiveBufferCount();
+    void setReceivePoll(const byte connectionCount);
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //queue
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    byte queue(const byte targetIP[], const unsigned int port, const byte eventType, const char event[], const char payload[] = "");  //convert IPAddress to 4 byte array
-    byte queue(const byte targetNode, const unsigned int port, const byte eventType, const char event[], const char payload[] = "");  //convert node number to 4 byte array
-    byte queue(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType,  const char event[], const char payload[] = "");  //main queue prototype
-
-    //convert event
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, char event[], const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(char event)"));
-      return queue(target, port, eventType, (const char*)event, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const int8_t event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(int8_t event)"));
-      return queue(target, port, eventType, (int)event, payload);  //Convert event to int. Needed to fix ambiguous overload warning.
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const byte event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(byte event)"));
-      return queue(target, port, eventType, (int)event, payload);  //Convert event to int. Needed to fix ambiguous overload warning.
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const int16_t event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(int event)"));
-      char eventChar[int16_tLengthMax + 1];
-      itoa(event, eventChar, 10);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const uint16_t event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(unsigned int event)"));
-      char eventChar[uint16_tLengthMax + 1];
-      utoa(event, eventChar, 10);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const int32_t event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(long event)"));
-      char eventChar[int32_tLengthMax + 1];
-      ltoa(event, eventChar, 10);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const uint32_t event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(unsigned long event)"));
-      char eventChar[uint32_tLengthMax + 1];
-      ultoa(event, eventChar, 10);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const __FlashStringHelper* event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(F() event)"));
-      char eventChar[sendEventLengthMax + 1];
-      FSHtoa(event, eventChar, sendEventLengthMax);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const String &event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(String event)"));
-      byte stringLength = event.length();
-      char eventChar[stringLength + 1];
-      for (byte counter = 0; counter < stringLength; counter++) {
-        eventChar[counter] = event[counter];  //I could probably just use c_str() instead but then I have to deal with the pointer
-      }
-      eventChar[stringLength] = 0;
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const IPAddress &event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(IPAddress event)"));
-      char eventChar[IPAddressLengthMax + 1];
-      EtherEvent.IPtoa(event, eventChar);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const double event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(double event)"));
-      char eventChar[doubleIntegerLengthMax + 1 + queueDoubleDecimalPlaces + 1];  //max integer length + decimal point + decimal places setting + null terminator
-      dtostrf(event, queueDoubleDecimalPlaces + 2, queueDoubleDecimalPlaces, eventChar);
-      return queue(target, port, eventType, (const char*)eventChar, payload);
-    }
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const float event, const char payload[] = "") {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(float event)"));
-      return queue(target, port, eventType, (double)event, payload);  //needed to fix ambiguous compiler warning
-    }
-
-    //convert payload
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const char event[], char payload[]) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(char payload)"));
-      return queue(target, port, eventType, event, (const char*)payload);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const event_t event, const int16_t payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(int payload)"));
-      char payloadChar[int16_tLengthMax + 1];
-      itoa(payload, payloadChar, 10);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const event_t event, const uint16_t payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(unsigned int payload)"));
-      char payloadChar[uint16_tLengthMax + 1];
-      utoa(payload, payloadChar, 10);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const event_t event, const int32_t payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(long payload)"));
-      char payloadChar[int32_tLengthMax + 1];
-      ltoa(payload, payloadChar, 10);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, const event_t event, const uint32_t payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(unsigned long payload)"));
-      char payloadChar[uint32_tLengthMax + 1];
-      ultoa(payload, payloadChar, 10);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, event_t event, const __FlashStringHelper* payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(F() payload)"));
-      char payloadChar[sendPayloadLengthMax + 1];
-      FSHtoa(payload, payloadChar, sendPayloadLengthMax);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, event_t event, const String &payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(String payload)"));
-      byte stringLength = payload.length();
-      char payloadChar[stringLength + 1];
-      for (byte counter = 0; counter < stringLength; counter++) {
-        payloadChar[counter] = payload[counter];  //I could probably just use c_str() instead but then I have to deal with the pointer
-      }
-      payloadChar[stringLength] = 0;
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, event_t event, const IPAddress &payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(String payload)"));
-      char payloadChar[IPAddressLengthMax + 1];
-      EtherEvent.IPtoa(payload, payloadChar);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-    template <typename target_t, typename event_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, event_t event, const double payload) {
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queue(double payload)"));
-      char payloadChar[doubleIntegerLengthMax + 1 + queueDoubleDecimalPlaces + 1];  //max integer length + decimal point + decimal places setting + null terminator
-      dtostrf(payload, queueDoubleDecimalPlaces + 2, queueDoubleDecimalPlaces, payloadChar);
-      return queue(target, port, eventType, event, payloadChar);
-    }
-
-    //convert event and payload
-    template <typename target_t>
-    byte queue(const target_t &target, const unsigned int port, const byte eventType, char event[], char payload[]) {
-      return queue(target, port, eventType, (const char*)event, (const char*)payload);
-    }
+    byte queue(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());  //main queue prototype
+    byte queue(const unsigned int targetNode, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());  //convert node number to 4 byte array
+    byte queue(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());  //convert IPAddress to 4 byte array
+    byte queue(const queueRecord_t records[], const byte recordCount, byte results[]);  //batch
+    byte queueAck(const byte targetIP[], const unsigned int port, const byte eventID);
+    byte queueAck(const unsigned int targetNode, const unsigned int port, const byte eventID);
+    byte queueAck(const IPAddress &targetIPAddress, const unsigned int port, const byte eventID);
+    void setAckPiggyback(const boolean ackPiggybackInput = true);
+    byte queueMulticast(const byte nodeMask[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());
+    boolean setStagingQueue(const byte slotCount, const byte stringLengthMax = 0);
+    boolean queueStaged(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());  //safe to call from an interrupt or another task
+    boolean queueStaged(const unsigned int targetNode, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());
+    boolean queueStaged(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload = value_t());
 
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //queueHandler - Sends out the messages in the queue. This function was moved to the header file so that the authentication disable system would work
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     boolean queueHandler(EthernetClient &ethernetClient) {
-      if (queueSize > internalEventQueueCount && (queueNewCount > 0 || millis() - queueSendTimestamp > resendDelay)) {  //there are events in the queue that are non-internal events and it is time(if there are new queue items then send immediately or if resend wait for the resendDelay)
+      const unsigned long workTimestamp = micros();
+      if (storageCount > 0 && queueSize < queueSizeMax) {  //there are stored events and free queue slots
+        storageReplay(workTimestamp);
+      }
+      if (stagingQueue != NULL && stagingHead != ETHEREVENTQUEUE_STAGING_GET(stagingTail) && queueSize < queueSizeMax) {  //there are staged events and free queue slots
+        stagingMove(workTimestamp);
+      }
+      const boolean resendDue = clockMillis() - queueSendTimestamp > resendDelay;
+      const boolean rateLimitRetryDue = rateLimitDeferredCount > 0 && (long)(clockMillis() - rateLimitRetryTimestamp) >= 0;  //a rate limit that held back events might allow a send now
+      if (queueSize > internalEventQueueCount && (queueNewCount > sendWindowBlockedCount || queueHandlerScanRemaining > 0 || resendDue || rateLimitRetryDue)) {  //there are events in the queue that are non-internal events and it is time(if there are new queue items that are not held back by the send window or an interrupted scan then send immediately or if resend wait for the resendDelay)
         ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: queueSize="));
         ETHEREVENTQUEUE_SERIAL.println(queueSize);
         ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: queueNewCount="));
         ETHEREVENTQUEUE_SERIAL.println(queueNewCount);
         byte queueSlotSend = 0;  //This is used to store the slot. Initialized to 0 to fix "may be uninitialized" compiler warning.
-        int8_t targetNode;
-        for (byte counter = 0; counter < queueSize; counter++) {  //the maximum number of iterations is the queueSize
-          if (queueNewCount == 0) {  //time to send the next one in the queue
-            //find the next largest priority level value
-            if (queuePriorityLevel == queueSize - 1 || queueIndex[queuePriorityLevel + 1] == -1) {  //the last sent item was already at the largest priority level value so send the queue item with smallest priority level value. The first statment(queuePriorityLevel == queueSize - 1) handles reaching the end of a full queue, the second statement(queueIndex[queuePriorityLevel + 1] == -1) handles reaching the empty portion of a partially filled queue
+        int targetNode;
+        boolean resend = false;  //the event has been sent or attempted before
+        boolean queueSlotFound = false;
+        const byte scanCount = queueHandlerScanRemaining > 0 ? queueHandlerScanRemaining : queueSize;  //an interrupted scan only checks the rest of the queue
+        const boolean resendScan = queueHandlerScanRemaining > 0 || resendDue || rateLimitRetryDue;  //the events that are not new are checked in this call
+        const boolean rateLimitRetryOnly = queueHandlerScanRemaining == 0 && !resendDue;  //the scan is only for the events held back by a rate limit
+        if (rateLimitRetryDue) {
+          rateLimitRetryTimestamp = clockMillis() + resendDelay;  //moved forward by the events that are still held back
+        }
+        queueHandlerScanRemaining = 0;
+        for (byte counter = 0; counter < queueSize && counter < scanCount; counter++) {  //the maximum number of iterations is the queueSize
+          if (counter > 0 && workBudgetExhausted(counter, workTimestamp)) {  //continue the scan on the next call
+            queueHandlerScanRemaining = scanCount - counter;
+            return true;
+          }
+          if (queueNewCount <= sendWindowBlockedCount) {  //time to send the next one in the queue
+            if (!resendScan || queueNewCount == queueSize) {  //the new events are held back by the send window and the other events are not due or there are none
+              break;
+            }
+            //find the next largest priority level value, the new events held back by the send window are skipped because they are sent in order as new events when the window opens
+            if (queuePriorityLevel >= queueSize - queueNewCount - 1 || queueIndex[queuePriorityLevel + 1] == -1) {  //the last sent item was already at the largest priority level value so send the queue item with smallest priority level value. The first statment(queuePriorityLevel >= queueSize - queueNewCount - 1) handles reaching the end of a full queue or the held back new events, the second statement(queueIndex[queuePriorityLevel + 1] == -1) handles reaching the empty portion of a partially filled queue
               queuePriorityLevel = 0;  //start from the least recently queued item
             }
             else {
               queuePriorityLevel++;  //go on to the next most recently queued item
             }
             queueSlotSend = queueIndex[queuePriorityLevel];
-            queueSendTimestamp = millis();  //reset the timestamp to delay the next queue resend
+            if (rateLimitRetryOnly) {
+              if (!(flagsQueue[queueSlotSend] & queueFlagRateLimited)) {  //the other events wait for the resendDelay
+                continue;
+              }
+            }
+            else {
+              queueSendTimestamp = clockMillis();  //reset the timestamp to delay the next queue resend
+            }
+            resend = flagsQueue[queueSlotSend] & queueFlagAttempted;  //an event held back by the send window or a rate limit might not have been attempted yet
           }
-          else {  //send the oldest new item in the queue
-            queueSlotSend = queueIndex[queueSize - queueNewCount];  //find the (queueNewCount)th largest priority level value
-            queueNewCount--;
+          else {  //send the oldest new item in the queue that is not held back by the send window
+            const byte newPosition = queueSize - queueNewCount + sendWindowBlockedCount;
+            queueSlotSend = queueIndex[newPosition];
+            if (sendWindowBlocked(queueSlotSend)) {  //the event stays new so it is sent in order as soon as the window opens
+              ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: send window full"));
+              sendWindowBlockedCount++;
+              continue;  //move on to the next queue step
+            }
+            newEventTake(newPosition);
+            resend = false;
           }
           ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: queueSlotSend="));
           ETHEREVENTQUEUE_SERIAL.println(queueSlotSend);
           targetNode = getNode(IPqueue[queueSlotSend]);  //get the node of the target IP
+          if ((flagsQueue[queueSlotSend] & queueFlagMulticast) && targetNode >= 0 && !(multicastMask[queueSlotSend * multicastMaskLength() + (targetNode >> 3)] & (1 << (targetNode & 7)))) {  //the current destination of the multicast event was ACKed since it was selected
+            const byte queueSizeBefore = queueSize;
+            multicastNext(queueSlotSend, false);
+            if (queueSize < queueSizeBefore) {  //all destinations were done so the event was removed
+              if (queueSize == 0) {  //no events left to send
+                return true;
+              }
+              continue;  //move on to the next queue step
+            }
+            targetNode = getNode(IPqueue[queueSlotSend]);
+          }
           ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: targetNode="));
           ETHEREVENTQUEUE_SERIAL.println(targetNode);
           ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: nodeDevice="));
           ETHEREVENTQUEUE_SERIAL.println(nodeDevice);
-          if (targetNode == nodeDevice) {  //ignore internal events, they are sent in availableEvent()
+          if (targetNode >= 0 && (unsigned int)targetNode == nodeDevice) {  //ignore internal events, they are sent in availableEvent()
             ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: nodeDevice=targetNode"));
             continue;  //move on to the next queue step
           }
           if (targetNode < 0) {  //-1 indicates no node match
             ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: non-node targetIP"));
+            if (circuitBreaker != NULL && circuitState(IPqueue[queueSlotSend], portQueue[queueSlotSend]) == circuitOpen) {  //sends to the target are failing
+              ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: circuit open"));
+              if (eventTypeQueue[queueSlotSend] == eventTypeOnce || eventTypeQueue[queueSlotSend] == eventTypeOverrideTimeout) {  //the send would fail so these are removed the same as after a failed send
+                remove(queueSlotSend);
+                stats.expired++;
+                if (queueSize == 0) {  //no events left to send
+                  return true;
+                }
+              }
+              continue;  //move on to the next queue step
+            }
+            if (rateLimitEnabled() && !rateLimitAllow(targetNode, queueSlotSend)) {  //held back or removed by the rate limit
+              if (queueSize == 0) {  //no events left to send
+                return true;
+              }
+              continue;  //move on to the next queue step
+            }
+            queueSlotFound = true;
             break;  //non-nodes never timeout
           }
 
-          if (millis() - nodeTimestamp[targetNode] < nodeTimeoutDuration || eventTypeQueue[queueSlotSend] == eventTypeOverrideTimeout) { //non-timed out node or eventTypeOverrideTimeout
+          if (clockMillis() - nodeTimestamp[targetNode] < nodeTimeout(targetNode) || eventTypeQueue[queueSlotSend] == eventTypeOverrideTimeout) { //non-timed out node or eventTypeOverrideTimeout
+            if (nodeWindow != NULL && eventTypeQueue[queueSlotSend] == eventTypeConfirm && !(flagsQueue[queueSlotSend] & (queueFlagSent | queueFlagMulticast)) && nodeWindow[targetNode].inFlight >= nodeWindow[targetNode].size) {  //the node's window of unACKed events is full
+              ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: send window full"));
+              continue;  //an event whose first send failed is sent on a later resend pass once the window opens
+            }
+            if (rateLimitEnabled() && !rateLimitAllow(targetNode, queueSlotSend)) {  //held back or removed by the rate limit
+              if (queueSize == 0) {  //no events left to send
+                return true;
+              }
+              continue;  //move on to the next queue step
+            }
+            queueSlotFound = true;
             break;  //continue with the message send
           }
           ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: targetNode timed out for queue#="));
           ETHEREVENTQUEUE_SERIAL.println(queueSlotSend);
-          remove(queueSlotSend);  //dump messages for dead nodes from the queue
+          if (flagsQueue[queueSlotSend] & queueFlagMulticast) {
+            multicastNext(queueSlotSend, true);  //only the timed out destination is dropped
+          }
+          else {
+            remove(queueSlotSend);  //dump messages for dead nodes from the queue
+          }
+          stats.timedOutDropped++;
           if (queueSize == 0) {  //no events left to send
             return true;
           }
         }
+        if (!queueSlotFound) {  //all the events that were checked were internal events, to timed out nodes, or blocked by the send window or a rate limit
+          return true;  //indicate no send required
+        }
 
         //set up the raw payload
-        char payload[strlen(payloadQueue[queueSlotSend]) + eventIDlength + 1];
+        const boolean payloadFlash = flagsQueue[queueSlotSend] & queueFlagPayloadFlash;
+        const unsigned int payloadLength = queueStringLength(payloadQueue[queueSlotSend], payloadFlash);
+        const int8_t ackSlot = ackPiggybackSlot(queueSlotSend, payloadLength);  //pending acks to the same target are sent along with the event
+        const unsigned int ackLength = ackSlot >= 0 ? strlen(payloadQueue[ackSlot]) + 2 : 0;  //the acks and the surrounding markers
+        char payload[payloadLength + eventIDlength + ackLength + 1];
         itoa(eventIDqueue[queueSlotSend], payload, 10);  //put the message ID on the start of the payload
-        strcat(payload, payloadQueue[queueSlotSend]);  //add the true payload to the payload string
+        if (ackSlot >= 0) {
+          payload[eventIDlength] = ackMarker;
+          strcpy(payload + eventIDlength + 1, payloadQueue[ackSlot]);
+          payload[eventIDlength + ackLength - 1] = ackMarker;
+        }
+        queueStringCopy(payload + eventIDlength + ackLength, payloadQueue[queueSlotSend], payloadFlash, sendPayloadLengthMax);  //add the true payload to the payload string, F() payloads are read from flash here
 
         ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: targetIP="));
         ETHEREVENTQUEUE_SERIAL.println(IPAddress(IPqueue[queueSlotSend]));
         ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: event="));
-        ETHEREVENTQUEUE_SERIAL.println(eventQueue[queueSlotSend]);
+        if (flagsQueue[queueSlotSend] & queueFlagEventFlash) {
+          ETHEREVENTQUEUE_SERIAL.println((const __FlashStringHelper*)flashReference(eventQueue[queueSlotSend]));
+        }
+        else {
+          ETHEREVENTQUEUE_SERIAL.println(eventQueue[queueSlotSend]);
+        }
         ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.queueHandler: payload="));
         ETHEREVENTQUEUE_SERIAL.println(payload);
 
-        if (EtherEvent.send(ethernetClient, (const byte*)IPqueue[queueSlotSend], portQueue[queueSlotSend], (const char*)eventQueue[queueSlotSend], (const char*)payload) > 0) {
+        if (resend) {
+          stats.resent++;
+          if (targetNode >= 0 && (flagsQueue[queueSlotSend] & queueFlagSent)) {  //the ACK is overdue
+            sendWindowLoss(targetNode, queueSlotSend);
+          }
+        }
+        if (!(flagsQueue[queueSlotSend] & queueFlagAttempted)) {  //first send attempt
+          flagsQueue[queueSlotSend] |= queueFlagAttempted;
+          latencyHistogramRecord(latencyHistogramAttempt, queueSlotSend);
+        }
+        if (flagsQueue[queueSlotSend] & queueFlagRateLimited) {  //the event is not held back anymore
+          flagsQueue[queueSlotSend] &= ~queueFlagRateLimited;
+          rateLimitDeferredCount--;
+          rateLimitRetryTimestamp = clockMillis();  //more held back events might be sendable already
+        }
+        const unsigned long sendStartTimestamp = micros();
+        boolean sendSuccess;
+        if (network != NULL) {
+          sendSuccess = networkSend(queueSlotSend, payload);
+        }
+        else if (flagsQueue[queueSlotSend] & queueFlagEventFlash) {  //the event is sent directly from flash
+          sendSuccess = EtherEvent.send(ethernetClient, (const byte*)IPqueue[queueSlotSend], portQueue[queueSlotSend], (const __FlashStringHelper*)flashReference(eventQueue[queueSlotSend]), (const char*)payload) > 0;
+        }
+        else {
+          sendSuccess = EtherEvent.send(ethernetClient, (const byte*)IPqueue[queueSlotSend], portQueue[queueSlotSend], (const char*)eventQueue[queueSlotSend], (const char*)payload) > 0;
+        }
+        if (targetNode >= 0) {  //the target IP is a node(-1 indicates no node match)
+          nodeStatsSendLatency(targetNode, micros() - sendStartTimestamp, sendSuccess);
+        }
+        else if (circuitBreaker != NULL) {
+          circuitSendResult(IPqueue[queueSlotSend], portQueue[queueSlotSend], sendSuccess);
+        }
+        if (sendSuccess) {
           ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: send successful"));
-          nodeTimestamp[nodeDevice] = millis();  //set the device timestamp(using the nodeDevice because that part of the array is never used otherwise)
+          stats.sent++;
+          if (!(flagsQueue[queueSlotSend] & queueFlagSent)) {  //first successful send
+            flagsQueue[queueSlotSend] |= queueFlagSent;
+            latencyHistogramRecord(latencyHistogramSend, queueSlotSend);
+            if (nodeWindow != NULL && targetNode >= 0 && eventTypeQueue[queueSlotSend] == eventTypeConfirm && !(flagsQueue[queueSlotSend] & queueFlagMulticast)) {  //the event is now waiting for an ACK
+              nodeWindow[targetNode].inFlight++;
+            }
+          }
           //update timestamp of the target node
-          targetNode = getNode(IPqueue[queueSlotSend]);  //get the node of the senderIP
           if (targetNode >= 0) {  //the target IP is a node(-1 indicates no node match)
-            nodeTimestamp[targetNode] = nodeTimestamp[nodeDevice];  //set the individual timestamp, any communication is considered to be a received keepalive - the nodeTimestamp for the device has just been set so I am using that variable so I don't have to call millis() twice for efficiency
-            sendKeepaliveTimestamp[targetNode] = nodeTimestamp[nodeDevice] - sendKeepaliveResendDelay;  //Treat successful send of any event as a sent keepalive so delay the send of the next keepalive. -sendKeepaliveResendDelay is so that sendKeepalive() will be able to queue the eventKeepalive according to "millis() - nodeTimestamp[node] > nodeTimeoutDuration - sendKeepaliveMargin" without being blocked by the "millis() - sendKeepaliveTimestamp[node] > sendKeepaliveResendDelay", it will not cause immediate queue of eventKeepalive because nodeTimestamp[targetNode] has just been set. The nodeTimestamp for the device has just been set so I am using that variable so I don't have to call millis() again
-            if (nodeState[targetNode] == nodeStateUnknown) {
-              nodeState[targetNode] = nodeStateActive;  //set the node state to active
-            }
+            nodeTimestampUpdate(targetNode, clockMillis());  //any communication is considered to be a received keepalive
+          }
+          if (ackSlot >= 0) {  //the piggy-backed acks don't need to be sent separately
+            ackPiggybackSent(ackSlot);
           }
 
-          if (eventTypeQueue[queueSlotSend] != eventTypeConfirm) {  //the flag indicates not to wait for an ack
+          if (flagsQueue[queueSlotSend] & queueFlagMulticast) {
+            multicastNext(queueSlotSend, eventTypeQueue[queueSlotSend] != eventTypeConfirm);  //eventTypeConfirm destinations stay pending until their ACK arrives
+          }
+          else if (eventTypeQueue[queueSlotSend] != eventTypeConfirm) {  //the flag indicates not to wait for an ack
             ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: eventType != eventTypeConfirm, event removed from queue"));
             remove(queueSlotSend);  //remove the message from the queue immediately
           }
@@ -413,9 +607,17 @@ class EtherEventQueueClass {
         }
         else {  //send failed
           ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.queueHandler: send failed"));
-          if (eventTypeQueue[queueSlotSend] == eventTypeOnce || eventTypeQueue[queueSlotSend] == eventTypeOverrideTimeout) {  //the flag indicates not to resend even after failure
+          stats.sendFailed++;
+          const boolean expire = eventTypeQueue[queueSlotSend] == eventTypeOnce || eventTypeQueue[queueSlotSend] == eventTypeOverrideTimeout;  //the flag indicates not to resend even after failure
+          if (flagsQueue[queueSlotSend] & queueFlagMulticast) {
+            multicastNext(queueSlotSend, expire);
+          }
+          else if (expire) {
             remove(queueSlotSend);  //remove keepalives even when send was not successful. This is because the keepalives are sent even to timed out nodes so they shouldn't be queued.
           }
+          if (expire) {
+            stats.expired++;
+          }
           return false;  //indicate send failed
         }
       }
@@ -424,41 +626,69 @@ class EtherEventQueueClass {
 
 
     void flushQueue();
-    int8_t checkTimeout();
-    int8_t checkTimein();
-    int8_t checkState(const byte node);
+    void setStorage(EtherEventQueueStorage &storageInput);
+    void setQueueBuffers(const byte eventBufferCount, const byte payloadBufferCount);
+    unsigned int getStorageCount();
+    int checkTimeout();
+    int checkTimein();
+    int8_t checkState(const unsigned int node);
 
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //getNode - template that can accept IPAddress or byte array type parameters - this function must be defined in the .h instead of the .cpp because it is a template
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     template <typename IP_t>
-    int8_t getNode(const IP_t &IPvalue) {
+    int getNode(const IP_t &IPvalue) {
       ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.getNode"));
-      for (byte node = 0; node < nodeCount; node++) {  //step through all the nodes
-        byte octet;
-        for (octet = 0; octet < 4; octet++) {
-          if (nodeIP[node][octet] != IPvalue[octet]) {  //mismatch
-            octet = 0;
-            break;  //check the next node for a match
-          }
-        }
-        if (octet == 4) {  //node matched
-          //ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.getNode: node found="));
-          //ETHEREVENTQUEUE_SERIAL.println(node);
-          return node;
-        }
-      }
-      ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.getNode: node not found"));
-      return -1;  //no match
+      return nodeFind(IPkey(IPvalue));
     }
 
 
     boolean checkQueueOverflow();
+    byte getQueueSize();
+    byte getQueueSizeMax();
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //entries - the events in the queue for a range-based for loop. No events or payloads are copied.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    entryRange_t entries() const {
+      const entryRange_t range = {entryIterator_t(*this, 0), entryIterator_t(*this, queueSize)};
+      return range;
+    }
+
+
+    byte removeIf(boolean (*predicate)(const entry_t &entry));
     void setResendDelay(const unsigned long resendDelayValue);
     unsigned long getResendDelay();
+    void setWorkBudget(const byte itemBudget, const unsigned long timeBudget = 0);
     void setNodeTimeoutDuration(const unsigned long nodeTimeoutDurationValue);
     unsigned long getNodeTimeoutDuration();
+    boolean setNodeTimeoutAdaptive(const boolean enable = true, const byte deviationFactor = 4, const unsigned long timeoutMin = 30000, const unsigned long timeoutMax = 900000);
+    unsigned long getNodeTimeout(const unsigned int nodeNumber);
+    boolean setDuplicateWindow(const unsigned long windowDuration, const unsigned int ackPort);
+    boolean setSendWindow(const byte windowSize, const boolean adaptive = false);
+    byte getSendWindow(const unsigned int nodeNumber);
+    void setClock(unsigned long (*clockFunctionInput)());
+    void setNetwork(EtherEventQueueNetwork &networkInput);
+    boolean setCircuitBreaker(const byte failureThreshold, const unsigned long openDuration = 60000, const byte breakerCount = 4);
+    boolean setRateLimit(const unsigned int nodeNumber, const unsigned long tokenInterval, const byte burst, const boolean drop = false);
+    void setRateLimitDefault(const unsigned long tokenInterval, const byte burst, const boolean drop = false);
+    int getRateLimitTokens(const unsigned int nodeNumber);
+    int getRateLimitDefaultTokens();
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //getCircuitState - template that can accept IPAddress or byte array type parameters - this function must be defined in the .h instead of the .cpp because it is a template
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    template <typename IP_t>
+    byte getCircuitState(const IP_t &IPvalue, const unsigned int port) {
+      byte IP[4];
+      IPcopy(IP, IPvalue);
+      return circuitState(IP, port);
+    }
+
+
 #ifdef ethernetclientwithremoteIP_h
     void receiveNodesOnly(const boolean receiveNodesOnlyValue = true);
 #endif
@@ -469,26 +699,35 @@ class EtherEventQueueClass {
     //setNode
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
     template <typename IP_t>
-    boolean setNode(const byte nodeNumber, const IP_t &nodeIPaddress) {
+    boolean setNode(const unsigned int nodeNumber, const IP_t &nodeIPaddress) {
       ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.setNode: node="));
       ETHEREVENTQUEUE_SERIAL.println(nodeNumber);
       if (nodeNumber >= nodeCount) {  //sanity check
         ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.setNode: invalid node number"));
         return false;
       }
-      //write the device IP address to nodeIP
-      for (byte counter = 0; counter < 4; counter++) {
-        nodeIP[nodeNumber][counter] = nodeIPaddress[counter];
-      }
-      nodeTimestamp[nodeNumber] = millis();
-      sendKeepaliveTimestamp[nodeNumber] = millis() - sendKeepaliveResendDelay;
-      nodeState[nodeNumber] = nodeStateUnknown;  //start in unknown state
+      byte IP[4];
+      IPcopy(IP, nodeIPaddress);
+      nodeSet(nodeNumber, IP, clockMillis());
+      nodeIndexInsert(nodeNumber);
       return true;
     }
 
-    void removeNode(const byte nodeNumber);
+    boolean setNodes(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count);
+    boolean setNodes_P(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count);
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //setNodeRange - map all addresses of a subnet to consecutive node numbers
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    template <typename IP_t>
+    boolean setNodeRange(const unsigned int firstNode, const IP_t &network, const byte prefixLength) {
+      return nodeRangeSet(firstNode, IPkey(network), prefixLength);
+    }
+
+    void removeNode(const unsigned int nodeNumber);
 
-    IPAddress getIP(const byte nodeNumber);
+    IPAddress getIP(const unsigned int nodeNumber);
     void sendKeepalive(const unsigned int port);
     unsigned long getSendKeepaliveMargin();
     void setSendKeepaliveMargin(const unsigned long sendKeepaliveMarginInput);
@@ -508,6 +747,16 @@ class EtherEventQueueClass {
     boolean setEventAck(const uint32_t eventAckInput);
     boolean setEventAck(const __FlashStringHelper* eventAckFSH);
     void setQueueDoubleDecimalPlaces(byte decimalPlaces);
+    value_t compact(value_t value);
+    void setPayloadCompression(const unsigned int payloadLengthMax);
+
+    const stats_t& getStats();
+    boolean setNodeStats(const boolean enable = true);
+    nodeStats_t getNodeStats(const unsigned int nodeNumber);
+    void resetStats();
+    void sendStats(const unsigned int targetNode, const unsigned int port, const value_t &event, const unsigned long interval);
+    boolean setLatencyHistogram(const boolean enable = true);
+    unsigned long getLatencyHistogram(const byte histogram, const byte bucket);
 
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -519,17 +768,50 @@ class EtherEventQueueClass {
     static const byte int16_tLengthMax = 1 + uint16_tLengthMax;  //sign + 5 digits
     static const byte uint32_tLengthMax = 10;  //10 digits
     static const byte int32_tLengthMax = 1 + uint32_tLengthMax;  //sign + 10 digits
-    static const byte IPAddressLengthMax = 3 + 1 + 3 + 1 + 3 + 1 + 3;  //4 x octet + 3 x dot
-    static const byte doubleIntegerLengthMax = 40;  //sign + 39 digits max (-1000000000000000000000000000000000000000 gives me "floating constant exceeds range of 'double'" warning)
 
     static const byte nodeStateTimedOut = 0;
     static const byte nodeStateActive = 1;
     static const byte nodeStateUnknown = 2;
 
     static const byte eventIDlength = 2;
+    static const char compactMarker = 0x1E;  //the first char of a compact encoded payload
+
+    //compressed payloads: compactMarker + compressedTag + LZ77 data. Literals are copied as is, a match is compressionEscape + offset + length, each stored as 0x20 + value so a match never contains a null, newline or compressionEscape. A literal compressionEscape is doubled.
+    static const char compressedTag = 'z';
+    static const char compressionEscape = 0x1F;
+    static const byte compressionWindow = 224;  //maximum match offset
+    static const byte compressionMatchLengthMin = 4;  //a match is 3 chars so shorter matches don't save anything
+    static const byte compressionMatchLengthMax = compressionMatchLengthMin + 0xFF - 0x20;
+    static const byte compressionHashBits = 6;  //the hash table of the last position of each 4 char sequence is 2^compressionHashBits positions
+
+    //flagsQueue bits
+    static const byte queueFlagAttempted = 1 << 0;  //a send of the event has been attempted
+    static const byte queueFlagSent = 1 << 1;  //the event has been successfully sent
+    static const byte queueFlagEventFlash = 1 << 2;  //the eventQueue entry is a pointer to an F() string instead of a buffer
+    static const byte queueFlagPayloadFlash = 1 << 3;  //the payloadQueue entry is a pointer to an F() string instead of a buffer
+    static const byte queueFlagAck = 1 << 4;  //the event is an ack queued by queueAck() that more eventIDs can be added to
+    static const byte queueFlagMulticast = 1 << 5;  //the event is sent to each node in its multicastMask, IPqueue holds the current destination
+    static const byte queueFlagMulticastResend = 1 << 6;  //all destinations of the multicast event have been attempted, the remaining ones are resends
+    static const byte queueFlagRateLimited = 1 << 7;  //the event is held back by a rate limit, it is sent as soon as the rate limit allows instead of waiting for the resendDelay
+
+    //ack batches: a list of eventIDs(e.g. "12,15") or, when that would be longer, a bitmap of all eventIDs
+    static const char ackMarker = 0x1D;  //surrounds acks piggy-backed on the start of an outgoing payload
+    static const char ackBitmapTag = 'b';  //follows compactMarker at the start of an ack bitmap
+    static const byte ackBitmapDigitCount = 15;  //90 eventIDs in 6 bit digits
+    static const byte ackBitmapLength = 2 + ackBitmapDigitCount;  //compactMarker + tag + digits
+    static const byte ackBitsLength = 12;  //bytes needed to hold a bit for each eventID
+
+    //persistent storage format: the header holds the record length, followed by a ring of fixed length records of state, sequence number, IP, port, eventType, event, payload
+    static const byte storageHeaderLength = 2;
+    static const byte storageRecordHeaderLength = 10;
+    static const byte storageStateEmpty = 0xFF;  //erased
+    static const byte storageStateValid = 0xA5;
+    static const byte storageStateConsumed = 0;  //only clears bits of storageStateValid so no erase is needed on flash
+    static const unsigned int storageRecordNone = 0xFFFF;
+    static const byte receiveBufferHeaderLength = 4;  //eventID, event length, payload length(2 bytes)
 
     //private global variables
-    byte nodeDevice;
+    unsigned int nodeDevice;
     unsigned int defaultPort;
     byte receivedEventLengthMax;
     byte receivedEventIDvalue;
@@ -537,6 +819,8 @@ class EtherEventQueueClass {
     unsigned int receivedPayloadLengthMax;
     char* receivedPayload;  //buffer to hold the received payload
     byte receivedEventLength;
+    value_t receivedPayloadValueData;  //typed value of the received payload
+    boolean receivedPayloadCompact;  //the received payload is compact encoded and has not been converted to a string in receivedPayload yet
     boolean receiveNodesOnlyState;  //restrict event receiving to nodes only
 
     byte queueSizeMax;
@@ -544,38 +828,179 @@ class EtherEventQueueClass {
     byte** IPqueue;  //queue buffers
     unsigned int* portQueue;
     byte sendEventLengthMax;
-    char** eventQueue;
+    char** eventQueue;  //a buffer from eventBufferPool or the F() string pointer, NULL for empty queue slots
     byte* eventIDqueue;  //unique identifier for the message
     unsigned int sendPayloadLengthMax;
-    char** payloadQueue;
+    char** payloadQueue;  //a buffer from payloadBufferPool or the F() string pointer, NULL for empty queue slots
     byte* eventTypeQueue;
+    unsigned long* queueTimestamp;  //the time the event was queued
+    byte* flagsQueue;
+
+    //event and payload buffers shared by the queue slots - see setQueueBuffers()
+    struct queueBufferPool_t {
+      char* buffers;
+      byte* freeIndex;  //stack of the indexes of the unused buffers
+      byte count;
+      byte freeCount;
+      byte countSetting;  //0 = a buffer for each queue slot
+    };
+    queueBufferPool_t eventBufferPool;
+    queueBufferPool_t payloadBufferPool;
 
     byte queueNewCount;  //number of new messages in the queue
     byte internalEventQueueCount;
     byte queueSize;  //how many messages are currently in the send queue
     byte queuePriorityLevel;  //the priority level of the last event sent
+    byte queueHandlerScanRemaining;  //queue items left to check by a queueHandler() scan that ran out of work budget, 0 = none
+    int8_t internalEventStep;  //the queue position availableEvent() checks next for internal events, -1 = start from the newest
     unsigned long queueSendTimestamp;  //used for delayed resends of messages in the queue that failed the first time
     byte queueOverflowFlag;
     unsigned long resendDelay;
     boolean sendNodesOnlyState;  //restrict event sending to nodes only
 
-    byte nodeCount;
-    byte** nodeIP;
+    unsigned int nodeCount;
+    byte (*nodeIP)[4];  //4 byte arrays are used for the IP addresses instead of IPAddress because IPAddress doesn't work with malloc
+    unsigned int* nodeIndex;  //numbers of the nodes set by setNode()/setNodes() sorted by IP address for the binary search in getNode()
+    unsigned int nodeIndexCount;
+
+    //subnet mapped to node numbers by setNodeRange()
+    struct nodeRange_t {
+      uint32_t network;
+      uint32_t mask;
+      unsigned int firstNode;
+    };
+    nodeRange_t* nodeRange;
+    byte nodeRangeCount;
     byte* nodeState;  //1=not timed out 0=timed out - state at the last check
     unsigned long* nodeTimestamp;
     unsigned long* sendKeepaliveTimestamp;
     unsigned long sendKeepaliveResendDelay;
     unsigned long nodeTimeoutDuration;
     unsigned long sendKeepaliveMargin;
+    unsigned int sendKeepaliveNode;  //the node sendKeepalive() checks next when the work budget is enabled
+
+    //adaptive node timeout - see setNodeTimeoutAdaptive()
+    unsigned long* nodeGapMean;  //(ms)moving average of the time between communications with the node, NULL when disabled
+    unsigned long* nodeGapDeviation;  //(ms)moving average of the deviation from nodeGapMean
+    byte nodeTimeoutDeviationFactor;
+    unsigned long nodeTimeoutMin;
+    unsigned long nodeTimeoutMax;
 
     char* eventKeepalive;
+    boolean eventKeepaliveFlash;  //eventKeepalive points to an F() string
     char* eventAck;
+    boolean eventAckFlash;  //eventAck points to an F() string
+    boolean ackPiggyback;  //send pending acks along with other events to the same target
+    byte eventIDlast;  //the most recently assigned eventID of the events to non-node targets
+    byte* nodeEventIDlast;  //the most recently assigned eventID of the events to each node, each node has its own rotation so the receiver's duplicate window sees consecutive eventIDs
+
+    //limit on unACKed eventTypeConfirm events per node - see setSendWindow()
+    struct nodeWindow_t {
+      byte inFlight;  //eventTypeConfirm events that have been sent and not ACKed yet
+      byte size;  //current window size
+      byte ackCount;  //ACKs since the last adaptive window increase
+    };
+    nodeWindow_t* nodeWindow;  //NULL when disabled
+    byte sendWindowSize;  //the maximum window size
+    boolean sendWindowAdaptive;
+    byte sendWindowBlockedCount;  //the oldest new events that are known to be held back by a full send window, they are checked again when an event is removed or the windows change
+
+    unsigned long (*clockFunction)();  //NULL when millis() is used - see setClock()
+    EtherEventQueueNetwork* network;  //NULL when EtherEvent is used - see setNetwork()
+
+    //circuit breakers for non-node targets - see setCircuitBreaker()
+    struct circuit_t {
+      byte IP[4];
+      unsigned int port;
+      byte failures;  //consecutive failed sends, 0 indicates an unused breaker
+      boolean open;
+      unsigned long openTimestamp;  //the time the breaker opened or the last probe failed
+    };
+    circuit_t* circuitBreaker;  //NULL when disabled
+    byte circuitBreakerCount;
+    byte circuitFailureThreshold;
+    unsigned long circuitOpenDuration;
+
+    //token bucket rate limits - see setRateLimit()
+    struct rateLimit_t {
+      unsigned long tokenInterval;  //(ms)time to add a token, 0 = not rate limited
+      unsigned long refillTimestamp;  //the time the last token was added
+      byte burst;  //maximum number of tokens
+      byte tokens;
+      boolean drop;  //eventTypeOnce and eventTypeOverrideTimeout events are removed instead of held back
+    };
+    rateLimit_t* nodeRateLimit;  //nodeCount rate limits, NULL until the first setRateLimit()
+    rateLimit_t defaultRateLimit;  //shared by all non-node targets
+    byte rateLimitDeferredCount;  //events in the queue with queueFlagRateLimited
+    unsigned long rateLimitRetryTimestamp;  //the time queueHandler() checks the events held back by a rate limit again
+
+    //duplicate suppression - see setDuplicateWindow()
+    byte* duplicateWindow;  //nodeCount x ackBitsLength bitmaps of the eventIDs received from each node, NULL when disabled
+    unsigned long* duplicateTimestamp;  //the time the last new event was received from each node
+    unsigned long duplicateWindowDuration;  //(ms)the window of a node is cleared when no new event was received from it for this long
+    unsigned int duplicateAckPort;
+    static const byte duplicateClearLength = 45;  //eventIDs after a received eventID that are cleared from the window, half the rotation
+
+    //pending destinations of multicast events - see queueMulticast()
+    byte* multicastMask;  //queueSizeMax x multicastMaskLength() bytes, NULL until the first queueMulticast()
+    byte* multicastEventID;  //queueSizeMax x nodeCount eventIDs, the eventID of each destination from its own rotation, 0 until the destination is attempted. NULL until the first queueMulticast()
+
+    //events staged by queueStaged() from interrupts or another task - see setStagingQueue()
+    queueRecord_t* stagingQueue;  //single producer single consumer ring buffer, NULL when disabled
+    byte stagingQueueLength;  //one slot more than the slotCount so a full ring can be told from an empty one
+    char* stagingStrings;  //an event and a payload string buffer of stagingStringLengthMax + 1 bytes for each slot, NULL when char array strings can't be staged
+    byte stagingStringLengthMax;
+    volatile byte stagingHead;  //the next record to move to the queue, only written by queueHandler()
+    volatile byte stagingTail;  //the next free record, only written by queueStaged()
+
+    //received events waiting to be read by the sketch - see setReceiveBuffer()
+    byte* receiveBuffer;  //ring buffer of records: header followed by the event and payload without null terminators, NULL when disabled
+    unsigned int receiveBufferSize;
+    unsigned int receiveBufferHead;  //position of the oldest record
+    unsigned int receiveBufferUsed;
+    unsigned int receiveBufferCount;  //number of records
+    byte receivePollCount;  //the maximum number of connections serviced by each availableEvent() call - see setReceivePoll()
+
+    //per call work limit of the entry points - see setWorkBudget()
+    byte workBudgetItems;  //0 = unlimited
+    unsigned long workBudgetTime;  //(us)0 = unlimited
 
     byte queueDoubleDecimalPlaces;
-
-
-    byte eventIDfind();
+    unsigned int compressionLengthMax;  //the maximum uncompressed payload length, 0 when compression is disabled - see setPayloadCompression()
+
+    static byte etherEventEventLengthMax;  //EtherEvent is shared by all instances so its buffers are sized for the largest instance
+    static unsigned int etherEventPayloadLengthMax;
+
+    stats_t stats;
+    nodeStats_t* nodeStats;  //nodeCount node statistics, NULL when disabled
+    unsigned long sendStatsTimestamp;
+    unsigned long* latencyHistogram;  //latencyHistogramCount x latencyHistogramBucketCount buckets, NULL when disabled
+
+    EtherEventQueueStorage* storage;  //NULL when persistent storage is not used
+    unsigned int storageRecordLength;
+    unsigned int storageRecordCount;  //number of records that fit in the storage
+    unsigned int storageHead;  //the record to write the next event to
+    unsigned int storageTail;  //the oldest record in use
+    unsigned int storageUsed;  //number of records from storageTail to storageHead, these are not overwritten
+    unsigned int storageReplayRecord;  //the next record to replay
+    unsigned int storageCount;  //number of stored events that have not been replayed yet
+    unsigned int* storageRecordQueue;  //the record of each queue slot holding a replayed eventTypeConfirm event, storageRecordNone for the other slots
+    uint16_t storageSequence;  //sequence number of the next record, used by storageBegin() to find the newest record
+    boolean storageReplaying;  //storageReplay() is queueing a stored event
+
+
+    byte eventIDfind(const int targetNode);
+    void eventIDsUsedFind(byte eventIDsUsed[]);
+    byte eventIDnext(byte eventIDsUsed[], const int targetNode);
+    boolean queueBufferPoolBegin(queueBufferPool_t &pool, const byte queueSizeMaxInput, const unsigned int lengthMax);
+    boolean queueBuffersAvailable(const value_t &event, const value_t &payload);
+    char* queueBufferTake(queueBufferPool_t &pool, const unsigned int lengthMax);
+    void queueBufferRelease(queueBufferPool_t &pool, const char buffer[], const unsigned int lengthMax);
+    void queueSlotBuffersRelease(const byte queueSlot);
+    void queueSlotWrite(const byte queueSlot, const byte targetIP[], const boolean internalEvent, const unsigned int port, const byte eventType, const value_t &event, const value_t &payload, const byte eventID);
     void remove(const byte queueStep);
+    int8_t overflowRemove();
+    entry_t entryGet(const byte queueSlot) const;
 
 
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -593,8 +1018,237 @@ class EtherEventQueueClass {
     }
 
 
-    boolean nodeIsSet(const byte nodeNumber);
-    void FSHtoa(const __FlashStringHelper* FlashString, char charBuffer[], byte maxLength);
+    boolean nodeIsSet(const unsigned int nodeNumber);
+    void nodeSet(const unsigned int nodeNumber, const byte IP[], const unsigned long timestamp);
+    void nodeTimestampUpdate(const unsigned int node, const unsigned long timestamp);
+    unsigned long nodeTimeout(const unsigned int node);
+    unsigned long nodeKeepaliveMargin(const unsigned int node, const unsigned long timeout);
+    int nodeFind(const uint32_t IPkeyValue);
+    void nodeIndexInsert(const unsigned int nodeNumber);
+    void nodeIndexRemove(const unsigned int nodeNumber);
+    boolean nodesSet(const unsigned int firstNode, const byte nodeIPs[][4], const unsigned int count, const boolean progmem);
+    boolean nodeRangeSet(const unsigned int firstNode, const uint32_t network, const byte prefixLength);
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //IPkey - returns the IP address as a 32 bit value with the first octet as the most significant byte so the keys sort in address order
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    template<typename IP_t>
+    uint32_t IPkey(const IP_t &IP) {
+      return ((uint32_t)IP[0] << 24) | ((uint32_t)IP[1] << 16) | ((uint32_t)IP[2] << 8) | IP[3];
+    }
+
+    void nodeStatsSendLatency(const unsigned int node, const unsigned long sendLatency, const boolean sendSuccess);
+    void latencyHistogramRecord(const byte histogram, const byte queueSlot);
+    boolean flashReferenceFits(const unsigned int lengthMax, const value_t &value);
+    boolean flashReferenceStore(char* &queueBuffer, const unsigned int lengthMax, const value_t &value);
+    PGM_P flashReference(const char queueBuffer[]) const;
+    unsigned int queueStringLength(const char queueBuffer[], const boolean flash);
+    void queueStringCopy(char destination[], const char queueBuffer[], const boolean flash, const unsigned int lengthMax);
+    boolean eventMatch(const char event[], const char referenceEvent[], const boolean referenceFlash);
+    byte eventIDparse(const char eventIDchar[]);
+    void receivedPayloadDecode();
+    boolean payloadCompress(char buffer[], const value_t &payload);
+    void payloadDecompress(char destination[], const char source[], const unsigned int lengthMax);
+    int8_t ackSlotFind(const byte targetIP[], const unsigned int port);
+    int8_t ackPiggybackSlot(const byte queueSlot, const unsigned int payloadLength);
+    boolean ackAppend(char ackList[], const byte eventID);
+    void ackBitsRead(const char ackList[], byte ackBits[]);
+    void ackBitsWrite(char ackList[], const byte ackBits[]);
+    void ackProcess(const char ackList[], const int senderNode);
+    unsigned int ackPiggybackReceive(char ackBlock[], const int senderNode);
+    void ackPiggybackSent(const byte ackSlot);
+    boolean duplicateCheck(const unsigned int node, const byte eventID);
+    void sendWindowReset();
+    void sendWindowAck(const byte queueSlot);
+    void sendWindowLoss(const unsigned int node, const byte queueSlot);
+    void sendWindowRemove(const byte queueSlot);
+    boolean sendWindowBlocked(const byte queueSlot);
+    void newEventTake(const byte position);
+    void multicastNext(const byte queueSlot, const boolean destinationDone);
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //multicastMaskLength - bytes needed for a bit for each node
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    unsigned int multicastMaskLength() {
+      return (nodeCount + 7) / 8;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //clockMillis - the time used for all timing. millis() unless another clock was set by setClock().
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    unsigned long clockMillis() const {
+      return clockFunction != NULL ? clockFunction() : millis();
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //rateLimitEnabled
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean rateLimitEnabled() {
+      return nodeRateLimit != NULL || defaultRateLimit.tokenInterval > 0;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //workBudgetEnabled
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean workBudgetEnabled() {
+      return workBudgetItems > 0 || workBudgetTime > 0;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //workBudgetExhausted - returns true if the work budget doesn't allow checking another item after itemCount items have been checked since workTimestamp(micros())
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean workBudgetExhausted(const unsigned int itemCount, const unsigned long workTimestamp) {
+      return (workBudgetItems > 0 && itemCount >= workBudgetItems) || (workBudgetTime > 0 && micros() - workTimestamp >= workBudgetTime);
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receiveAvailableEvent - check the network for a new event. This function is in the header file so that the authentication disable system would work
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    byte receiveAvailableEvent(EthernetServer &ethernetServer, const long cookieInput) {
+#ifndef ETHEREVENT_NO_AUTHENTICATION
+      return network != NULL ? network->availableEvent() : EtherEvent.availableEvent(ethernetServer, cookieInput);
+#else  //ETHEREVENT_NO_AUTHENTICATION
+      (void)cookieInput;
+      return network != NULL ? network->availableEvent() : EtherEvent.availableEvent(ethernetServer);
+#endif  //ETHEREVENT_NO_AUTHENTICATION
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receiveEvent - read the new event from the network to the buffers and process it. The caller flushes the network afterwards. Returns true if the event is for the sketch, false if it was handled by EtherEventQueue(keepalive, ack, duplicate or unauthorized IP)
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean receiveEvent(const byte availableBytesEvent, char eventBuffer[], char payloadBuffer[], byte &eventIDvalue) {
+      ETHEREVENTQUEUE_SERIAL.println(F("---------------------------"));
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: EtherEvent.availableEvent()="));
+      ETHEREVENTQUEUE_SERIAL.println(availableBytesEvent);
+#ifdef ethernetclientwithremoteIP_h  //this function is only available if the modified Ethernet library is installed
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: remoteIP="));
+      ETHEREVENTQUEUE_SERIAL.println(network != NULL ? network->senderIP() : EtherEvent.senderIP());
+#endif  //ethernetclientwithremoteIP_h
+
+#ifdef ethernetclientwithremoteIP_h  //this function is only available if the modified Ethernet library is installed
+      //update timestamp of the event sender
+      const int senderNode = getNode(network != NULL ? network->senderIP() : EtherEvent.senderIP());  //get the node of the senderIP
+      if (senderNode >= 0) {  //receivedIP is a node(-1 indicates no node match)
+        nodeTimestampUpdate(senderNode, clockMillis());  //any communication is considered to be a received keepalive
+        if (nodeStats != NULL) {
+          nodeStats[senderNode].receiveCount++;
+        }
+      }
+      else if (receiveNodesOnlyState == 1) {  //the event was not received from a node and it is configured to receive events from node IPs only
+        ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: unauthorized IP"));
+        return false;  //the event is not read, availableEvent() flushes it
+      }
+      const int ackSenderNode = senderNode;
+#else  //ethernetclientwithremoteIP_h
+      const int ackSenderNode = -1;  //the sender is unknown so multicast events can't be acknowledged
+#endif  //ethernetclientwithremoteIP_h
+
+      const unsigned int receivedEventRawLengthMax = network != NULL ? availableBytesEvent : etherEventEventLengthMax;
+      if (receivedEventLengthMax >= receivedEventRawLengthMax) {  //the event fits in the buffer
+        receiveReadEvent(eventBuffer);  //put the event in the buffer
+      }
+      else {  //the EtherEvent buffer was sized by another instance with a longer receivedEventLengthMax
+        char receivedEventRaw[receivedEventRawLengthMax + 1];
+        receiveReadEvent(receivedEventRaw);
+        queueStringCopy(eventBuffer, receivedEventRaw, false, receivedEventLengthMax);
+      }
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: event="));
+      ETHEREVENTQUEUE_SERIAL.println(eventBuffer);
+
+      if (eventKeepalive != NULL && eventMatch(eventBuffer, eventKeepalive, eventKeepaliveFlash)) {  //keepalive received
+        ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: keepalive received"));
+        stats.keepaliveReceived++;
+        return false;  //receive keepalive silently
+      }
+
+      const unsigned int payloadLength = receiveAvailablePayload();
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: EtherEvent.availablePayload()="));
+      ETHEREVENTQUEUE_SERIAL.println(payloadLength);
+      char receivedPayloadRaw[payloadLength];
+      receiveReadPayload(receivedPayloadRaw);  //read the payload to the buffer
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: rawPayload="));
+      ETHEREVENTQUEUE_SERIAL.println(receivedPayloadRaw);
+
+      //break the payload down into parts and convert the eventID to byte, the true payload stays as a char array
+      //the first part of the raw payload is the eventID
+      eventIDvalue = payloadLength >= eventIDlength ? eventIDparse(receivedPayloadRaw) : 0;
+      ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: eventID="));
+      ETHEREVENTQUEUE_SERIAL.println(eventIDvalue);
+
+      const unsigned int ackLength = payloadLength > eventIDlength + 1 && receivedPayloadRaw[eventIDlength] == ackMarker ? ackPiggybackReceive(receivedPayloadRaw + eventIDlength, ackSenderNode) : 0;  //acks were piggy-backed on the event
+#ifdef ethernetclientwithremoteIP_h  //the sender is only known if the modified Ethernet library is installed
+      if (duplicateWindow != NULL && senderNode >= 0 && eventIDvalue >= 10 && !(eventAck != NULL && eventMatch(eventBuffer, eventAck, eventAckFlash)) && duplicateCheck(senderNode, eventIDvalue)) {  //the event is a retransmission of an event that was already received
+        return false;  //drop duplicates silently
+      }
+#endif  //ethernetclientwithremoteIP_h
+
+      if (payloadLength > eventIDlength + ackLength + 1) {  //there is a true payload
+        const char* receivedPayloadTrue = receivedPayloadRaw + eventIDlength + ackLength;
+        if (receivedPayloadTrue[0] == compactMarker && receivedPayloadTrue[1] == compressedTag) {  //compressed payload
+          payloadDecompress(payloadBuffer, receivedPayloadTrue + 2, receivedPayloadLengthMax);
+        }
+        else {
+          queueStringCopy(payloadBuffer, receivedPayloadTrue, false, receivedPayloadLengthMax);  //longer payloads are truncated
+        }
+        ETHEREVENTQUEUE_SERIAL.print(F("EtherEventQueue.availableEvent: receivedPayload="));
+        ETHEREVENTQUEUE_SERIAL.println(payloadBuffer);
+      }
+      else {  //no true payload
+        payloadBuffer[0] = 0;  //clear the payload buffer
+      }
+
+      if (eventAck != NULL && eventMatch(eventBuffer, eventAck, eventAckFlash)) {  //ack handler
+        ETHEREVENTQUEUE_SERIAL.println(F("EtherEventQueue.availableEvent: ack received"));
+        ackProcess(payloadBuffer, ackSenderNode);  //the payload is a single eventID or a batch of them
+        return false;  //receive ack silently
+      }
+
+      return true;
+    }
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receiveBufferRecordLengthMax - the receive buffer space needed to accept any event
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    unsigned int receiveBufferRecordLengthMax() {
+      return receiveBufferHeaderLength + receivedEventLengthMax + receivedPayloadLengthMax;
+    }
+
+    void receiveBufferWrite(const byte data[], const unsigned int length);
+    void receiveBufferRead(byte data[], const unsigned int length);
+    void receiveBufferPush(const byte eventID, const char event[], const char payload[]);
+    void receiveBufferPop();
+    void receiveReadEvent(char eventBuffer[]);
+    unsigned int receiveAvailablePayload();
+    void receiveReadPayload(char payloadBuffer[]);
+    void receiveFlush();
+    boolean networkSend(const byte queueSlot, const char payload[]);
+    circuit_t* circuitFind(const byte IP[], const unsigned int port);
+    byte circuitState(const byte IP[], const unsigned int port);
+    boolean rateLimitAllow(const int targetNode, const byte queueSlot);
+    void rateLimitRefill(rateLimit_t &rateLimit);
+    void circuitSendResult(const byte IP[], const unsigned int port, const boolean sendSuccess);
+    void storageBegin();
+    boolean storageAppend(const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload);
+    void storageReplay(const unsigned long workTimestamp);
+    boolean stagingAppend(const int targetNode, const byte targetIP[], const unsigned int port, const byte eventType, const value_t &event, const value_t &payload);
+    value_t stagingValueCopy(const value_t &value, char buffer[]);
+    void stagingMove(const unsigned long workTimestamp);
+    void storageFlush();
+    void storageRecordRelease(const byte queueSlot);
+    void storageTrim();
+    unsigned int storageRecordAddress(const unsigned int record);
+    uint16_t storageReadWord(const unsigned int address);
+    void storageWriteWord(const unsigned int address, const uint16_t value);
+    void storageReadString(char destination[], const unsigned int address, const unsigned int lengthMax);
+    void storageWriteString(const unsigned int address, const char string[], const unsigned int lengthMax);
 };
 extern EtherEventQueueClass EtherEventQueue;  //declare the class so it doesn't have to be done in the sketch
 #endif
@@ -0,0 +1,44 @@
+// EtherEventQueueEEPROM - EEPROM storage for EtherEventQueue.setStorage(): http://github.com/per1234/EtherEventQueue
+#ifndef EtherEventQueueEEPROM_h
+#define EtherEventQueueEEPROM_h
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "EtherEventQueue.h"
+
+
+class EtherEventQueueEEPROM : public EtherEventQueueStorage {
+  public:
+    EtherEventQueueEEPROM(const unsigned int startAddressInput, const unsigned int lengthInput) {
+      startAddress = startAddressInput;
+      storageLength = lengthInput;
+    }
+
+    unsigned int length() {
+      return storageLength;
+    }
+
+    byte read(const unsigned int address) {
+      return EEPROM.read(startAddress + address);
+    }
+
+    void write(const unsigned int address, const byte value) {
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+      EEPROM.write(startAddress + address, value);  //the emulated EEPROM is buffered in RAM until commit()
+#else
+      EEPROM.update(startAddress + address, value);  //only write bytes that have changed to reduce EEPROM wear
+#endif
+    }
+
+    void commit() {
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+      EEPROM.commit();
+#endif
+    }
+
+  private:
+    unsigned int startAddress;
+    unsigned int storageLength;
+};
+#endif
+
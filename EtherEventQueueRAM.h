@@ -0,0 +1,34 @@
+// EtherEventQueueRAM - RAM storage for EtherEventQueue.setStorage(): http://github.com/per1234/EtherEventQueue
+// The contents only survive a call of EtherEventQueue.begin(), not a reset or power loss, so this is useful for testing the storage feature without wearing the EEPROM or as a spill area for a queue that is too large to be preallocated.
+#ifndef EtherEventQueueRAM_h
+#define EtherEventQueueRAM_h
+
+#include <Arduino.h>
+#include "EtherEventQueue.h"
+
+
+class EtherEventQueueRAM : public EtherEventQueueStorage {
+  public:
+    EtherEventQueueRAM(byte buffer[], const unsigned int lengthInput) {
+      storageBuffer = buffer;
+      storageLength = lengthInput;
+      memset(storageBuffer, 0xFF, storageLength);  //erased state, the same as blank EEPROM
+    }
+
+    unsigned int length() {
+      return storageLength;
+    }
+
+    byte read(const unsigned int address) {
+      return storageBuffer[address];
+    }
+
+    void write(const unsigned int address, const byte value) {
+      storageBuffer[address] = value;
+    }
+
+  private:
+    byte* storageBuffer;
+    unsigned int storageLength;
+};
+#endif
@@ -0,0 +1,351 @@
+// EtherEventQueueWorker - runs EtherEventQueue in a dedicated network thread on targets with POSIX threads(ESP32, Linux): http://github.com/per1234/EtherEventQueue
+#ifndef EtherEventQueueWorker_h
+#define EtherEventQueueWorker_h
+
+#include <Arduino.h>
+#include <pthread.h>
+#include <time.h>
+#include "EtherEventQueue.h"
+
+
+class EtherEventQueueWorker {
+  public:
+    EtherEventQueueWorker(EtherEventQueueClass &etherEventQueueInput = EtherEventQueue) : etherEventQueue(etherEventQueueInput) {
+      running = false;
+      threadStarted = false;
+      slotCount = 0;
+      eventLengthMax = 0;
+      payloadLengthMax = 0;
+      sendQueue = NULL;
+      sendStrings = NULL;
+      sendHead = 0;
+      sendCount = 0;
+      receiveQueue = NULL;
+      receiveHead = 0;
+      receiveCount = 0;
+      pthread_mutex_init(&mutex, NULL);  //the mutex exists as long as the worker so the application threads can always lock it to check running
+      pthread_cond_init(&sendCondition, NULL);
+      pthread_cond_init(&receiveCondition, NULL);
+    }
+
+
+    //the worker must not be used by any other thread when it is destroyed
+    ~EtherEventQueueWorker() {
+      end();
+      pthread_cond_destroy(&receiveCondition);
+      pthread_cond_destroy(&sendCondition);
+      pthread_mutex_destroy(&mutex);
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //begin - start the worker thread. EtherEventQueue must be configured before, from then on it must only be used through the worker until end().
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean begin(EthernetClient &ethernetClientInput, EthernetServer &ethernetServerInput, const byte slotCountInput, const byte eventLengthMaxInput, const unsigned int payloadLengthMaxInput, const unsigned int keepalivePortInput = 0, const unsigned long pollIntervalInput = 1) {
+      pthread_mutex_lock(&mutex);
+      if (threadStarted || slotCountInput == 0) {  //running or a previous end() hasn't finished
+        pthread_mutex_unlock(&mutex);
+        return false;
+      }
+      ethernetClient = &ethernetClientInput;
+      ethernetServer = &ethernetServerInput;
+      slotCount = slotCountInput;
+      eventLengthMax = eventLengthMaxInput;
+      payloadLengthMax = payloadLengthMaxInput;
+      keepalivePort = keepalivePortInput;
+      pollInterval = pollIntervalInput;
+      sendHead = 0;
+      sendCount = 0;
+      receiveHead = 0;
+      receiveCount = 0;
+      sendQueue = (EtherEventQueueClass::queueRecord_t*)calloc(slotCount, sizeof(EtherEventQueueClass::queueRecord_t));
+      sendStrings = (char*)malloc(slotCount * (eventLengthMax + 1 + payloadLengthMax + 1));  //event and payload strings of each send record
+      receiveQueue = (char*)malloc(slotCount * receiveRecordLength());
+      if (sendQueue == NULL || sendStrings == NULL || receiveQueue == NULL) {
+        freeBuffers();
+        pthread_mutex_unlock(&mutex);
+        return false;
+      }
+      running = true;
+      pthread_attr_t attributes;
+      pthread_attr_init(&attributes);
+      pthread_attr_setstacksize(&attributes, workerStackSize);
+      const boolean success = pthread_create(&thread, &attributes, workerThread, this) == 0;  //the worker thread waits for the mutex until begin() is done
+      pthread_attr_destroy(&attributes);
+      if (!success) {
+        running = false;
+        freeBuffers();
+      }
+      threadStarted = success;
+      pthread_mutex_unlock(&mutex);
+      return success;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //end - stop the worker thread. Events that were not moved to the queue or received events that were not read are discarded. Other threads may still call the worker functions during and after end(), they return false.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    void end() {
+      pthread_mutex_lock(&mutex);
+      if (!running) {  //not running or another thread is already ending it
+        pthread_mutex_unlock(&mutex);
+        return;
+      }
+      running = false;  //from now on the other threads don't use the buffers
+      pthread_cond_signal(&sendCondition);
+      pthread_cond_broadcast(&receiveCondition);  //receive() calls waiting for an event return
+      pthread_mutex_unlock(&mutex);
+      pthread_join(thread, NULL);
+      pthread_mutex_lock(&mutex);
+      freeBuffers();
+      threadStarted = false;  //begin() can start a new worker thread now
+      pthread_mutex_unlock(&mutex);
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //queue - thread safe EtherEventQueue.queue(). char array strings are copied, longer strings are truncated to the eventLengthMax and payloadLengthMax set by begin(). Returns false if the worker is not running or all slots are used.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean queue(const byte targetIP[], const unsigned int port, const byte eventType, const EtherEventQueueClass::value_t &event, const EtherEventQueueClass::value_t &payload = EtherEventQueueClass::value_t()) {
+      return sendAppend(-1, targetIP, port, eventType, event, payload);
+    }
+
+
+    //node target, the node is checked when the event is queued
+    boolean queue(const unsigned int targetNode, const unsigned int port, const byte eventType, const EtherEventQueueClass::value_t &event, const EtherEventQueueClass::value_t &payload = EtherEventQueueClass::value_t()) {
+      const byte targetIP[4] = {0, 0, 0, 0};  //not used
+      return sendAppend(targetNode, targetIP, port, eventType, event, payload);
+    }
+
+
+    //convert IPAddress to 4 byte array
+    boolean queue(const IPAddress &targetIPAddress, const unsigned int port, const byte eventType, const EtherEventQueueClass::value_t &event, const EtherEventQueueClass::value_t &payload = EtherEventQueueClass::value_t()) {
+      const byte targetIP[4] = {targetIPAddress[0], targetIPAddress[1], targetIPAddress[2], targetIPAddress[3]};
+      return sendAppend(-1, targetIP, port, eventType, event, payload);
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receive - thread safe read of the oldest received event. eventBuffer must have room for eventLengthMax + 1 and payloadBuffer for payloadLengthMax + 1 chars. Waits up to timeout(ms) for an event. Returns false if no event was received.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean receive(char eventBuffer[], char payloadBuffer[], byte &eventID, const unsigned long timeout = 0) {
+      pthread_mutex_lock(&mutex);
+      if (running && receiveCount == 0 && timeout > 0) {
+        timespec deadline;
+        deadlineSet(deadline, timeout);
+        while (running && receiveCount == 0 && pthread_cond_timedwait(&receiveCondition, &mutex, &deadline) == 0);
+      }
+      if (!running || receiveCount == 0) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+      }
+      const char* record = receiveQueue + receiveHead * receiveRecordLength();
+      eventID = record[0];
+      strcpy(eventBuffer, record + 1);
+      strcpy(payloadBuffer, record + 1 + eventLengthMax + 1);
+      receiveHead = receiveHead + 1 < slotCount ? receiveHead + 1 : 0;
+      receiveCount--;
+      pthread_mutex_unlock(&mutex);
+      return true;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //availableEvent - returns the number of received events waiting to be read with receive()
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    byte availableEvent() {
+      pthread_mutex_lock(&mutex);
+      const byte count = running ? receiveCount : 0;
+      pthread_mutex_unlock(&mutex);
+      return count;
+    }
+
+
+  private:
+    static const unsigned int workerStackSize = 8192;  //availableEvent() and queueHandler() put the event and payload buffers on the stack
+
+    EtherEventQueueClass &etherEventQueue;
+    EthernetClient* ethernetClient;
+    EthernetServer* ethernetServer;
+    unsigned int keepalivePort;  //0 = no keepalives
+    unsigned long pollInterval;  //(ms)the time the worker waits for new events when there is nothing to do
+    pthread_t thread;
+    pthread_mutex_t mutex;  //protects running, threadStarted and the send and receive queues
+    pthread_cond_t sendCondition;  //signaled when an event is added to the send queue
+    pthread_cond_t receiveCondition;  //signaled when an event is added to the receive queue or the worker ends
+    boolean running;  //the buffers are allocated and the worker thread is working
+    boolean threadStarted;  //the worker thread was started by begin() and end() hasn't joined it and freed the buffers yet
+    byte slotCount;
+    byte eventLengthMax;
+    unsigned int payloadLengthMax;
+    EtherEventQueueClass::queueRecord_t* sendQueue;  //events queued by the application threads and not moved to EtherEventQueue yet
+    char* sendStrings;  //the copies of the char array strings of the send records
+    byte sendHead;
+    byte sendCount;
+    char* receiveQueue;  //records of eventID, event and payload
+    byte receiveHead;
+    byte receiveCount;
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receiveRecordLength
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    unsigned int receiveRecordLength() {
+      return 1 + eventLengthMax + 1 + payloadLengthMax + 1;
+    }
+
+
+    void freeBuffers() {
+      free(sendQueue);
+      sendQueue = NULL;
+      free(sendStrings);
+      sendStrings = NULL;
+      free(receiveQueue);
+      receiveQueue = NULL;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //deadlineSet - the absolute time timeout(ms) from now for pthread_cond_timedwait()
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    static void deadlineSet(timespec &deadline, const unsigned long timeout) {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += timeout / 1000;
+      deadline.tv_nsec += (timeout % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //sendAppend - add an event to the send queue, copying the char array strings
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    boolean sendAppend(const int targetNode, const byte targetIP[], const unsigned int port, const byte eventType, const EtherEventQueueClass::value_t &event, const EtherEventQueueClass::value_t &payload) {
+      pthread_mutex_lock(&mutex);
+      if (!running || sendCount == slotCount) {  //not running or full
+        pthread_mutex_unlock(&mutex);
+        return false;
+      }
+      const byte slot = (sendHead + sendCount) % slotCount;
+      EtherEventQueueClass::queueRecord_t &record = sendQueue[slot];
+      record.targetNode = targetNode;
+      for (byte counter = 0; counter < 4; counter++) {
+        record.targetIP[counter] = targetIP[counter];
+      }
+      record.port = port;
+      record.eventType = eventType;
+      char* eventString = sendStrings + slot * (eventLengthMax + 1 + payloadLengthMax + 1);
+      char* payloadString = eventString + eventLengthMax + 1;
+      record.event = valueCopy(event, eventString, eventLengthMax);
+      record.payload = valueCopy(payload, payloadString, payloadLengthMax);
+      sendCount++;
+      pthread_cond_signal(&sendCondition);
+      pthread_mutex_unlock(&mutex);
+      return true;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //valueCopy - char array strings are copied to buffer because the application thread can change them before the worker queues the event. Other values are stored in the value_t.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    static EtherEventQueueClass::value_t valueCopy(const EtherEventQueueClass::value_t &value, char buffer[], const unsigned int lengthMax) {
+      if (value.type != EtherEventQueueClass::value_t::typeString) {
+        return value;
+      }
+      strncpy(buffer, value.data.string, lengthMax);
+      buffer[lengthMax] = 0;
+      return EtherEventQueueClass::value_t((const char*)buffer);
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //receiveRead - read the event received by EtherEventQueue to a receive record
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    void receiveRead(char record[], const byte availableBytesEvent) {
+      char event[availableBytesEvent + 1];  //the length of internal events doesn't include the null terminator
+      etherEventQueue.readEvent(event);
+      const unsigned int payloadLength = etherEventQueue.availablePayload();
+      char payload[payloadLength + 1];  //availablePayload() is 0 for an empty payload
+      etherEventQueue.readPayload(payload);
+      record[0] = etherEventQueue.receivedEventID();
+      char* eventString = record + 1;
+      strncpy(eventString, event, eventLengthMax);
+      eventString[eventLengthMax] = 0;
+      char* payloadString = eventString + eventLengthMax + 1;
+      strncpy(payloadString, payload, payloadLengthMax);
+      payloadString[payloadLengthMax] = 0;
+      etherEventQueue.flushReceiver();
+    }
+
+
+    static void* workerThread(void* worker) {
+      ((EtherEventQueueWorker*)worker)->work();
+      return NULL;
+    }
+
+
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //work - the worker thread. The network is only used while the mutex is unlocked so the application threads are not blocked by sends and receives.
+    /////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    void work() {
+      pthread_mutex_lock(&mutex);
+      while (running) {
+        //move the events queued by the application threads to EtherEventQueue while there are free queue slots
+        boolean idle = true;
+        while (sendCount > 0 && etherEventQueue.getQueueSize() < etherEventQueue.getQueueSizeMax()) {
+          const EtherEventQueueClass::queueRecord_t &record = sendQueue[sendHead];
+          if (record.targetNode >= 0) {
+            etherEventQueue.queue((unsigned int)record.targetNode, record.port, record.eventType, record.event, record.payload);
+          }
+          else {
+            etherEventQueue.queue(record.targetIP, record.port, record.eventType, record.event, record.payload);
+          }
+          sendHead = sendHead + 1 < slotCount ? sendHead + 1 : 0;
+          sendCount--;
+          idle = false;
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (keepalivePort > 0) {
+          etherEventQueue.sendKeepalive(keepalivePort);
+        }
+        const unsigned long sentCount = etherEventQueue.getStats().sent;
+        etherEventQueue.queueHandler(*ethernetClient);
+        if (etherEventQueue.getStats().sent != sentCount) {
+          idle = false;
+        }
+
+        //receive while there are free receive slots. The application threads only read the slots before the tail so the tail slot is written without locking the mutex.
+        while (true) {
+          pthread_mutex_lock(&mutex);
+          const boolean receiveFull = receiveCount == slotCount;
+          const byte receiveTail = (receiveHead + receiveCount) % slotCount;
+          pthread_mutex_unlock(&mutex);
+          if (receiveFull) {
+            break;
+          }
+          const byte availableBytesEvent = etherEventQueue.availableEvent(*ethernetServer);
+          if (availableBytesEvent == 0) {
+            break;
+          }
+          receiveRead(receiveQueue + receiveTail * receiveRecordLength(), availableBytesEvent);
+          pthread_mutex_lock(&mutex);
+          receiveCount++;
+          pthread_cond_signal(&receiveCondition);
+          pthread_mutex_unlock(&mutex);
+          idle = false;
+        }
+
+        pthread_mutex_lock(&mutex);
+        if (idle && sendCount == 0 && running) {  //wait for an application thread to queue an event or the poll interval to pass
+          timespec deadline;
+          deadlineSet(deadline, pollInterval);
+          pthread_cond_timedwait(&sendCondition, &mutex, &deadline);
+        }
+      }
+      pthread_mutex_unlock(&mutex);
+    }
+};
+#endif
@@ -0,0 +1,73 @@
+// Example script for the EtherEventQueue library. Demonstrates queueing a batch of events with a single EtherEventQueue.queue() call and benchmarks it against queueing the events one at a time.
+// A report of readingCount readings is queued repeatedly, once with a call of EtherEventQueue.queue() for each reading and once as a batch. The queue is flushed after each report so no events are sent.
+// The time taken to queue a report by each method is printed to the serial monitor.
+// No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const byte readingCount = 20;  //the number of events in each report
+const unsigned int reportCount = 200;  //the number of reports queued by each method
+const unsigned int port = 1024;
+const unsigned int collectorNode = 1;
+const IPAddress collectorIP(192, 168, 69, 105);  //not used, the events are never sent
+
+
+EtherEventQueueClass::queueRecord_t report[readingCount];
+byte results[readingCount];
+
+
+void setup() {
+  Serial.begin(9600);
+  if (EtherEventQueue.begin(0, 2, readingCount, 10, 10, 10, 10) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+  EtherEventQueue.setNode(collectorNode, collectorIP);
+
+  for (byte reading = 0; reading < readingCount; reading++) {
+    report[reading].targetNode = collectorNode;
+    report[reading].port = port;
+    report[reading].eventType = EtherEventQueue.eventTypeOnce;
+    report[reading].event = F("reading");
+    report[reading].payload = analogRead(A0) + reading;
+  }
+
+  Serial.println(F("method,events,duration(us),per report(us)"));
+
+  unsigned long timestamp = micros();
+  for (unsigned int count = 0; count < reportCount; count++) {
+    for (byte reading = 0; reading < readingCount; reading++) {
+      EtherEventQueue.queue(collectorNode, port, EtherEventQueue.eventTypeOnce, F("reading"), report[reading].payload);
+    }
+    EtherEventQueue.flushQueue();
+  }
+  printResult(F("queue() per event"), micros() - timestamp);
+
+  timestamp = micros();
+  for (unsigned int count = 0; count < reportCount; count++) {
+    EtherEventQueue.queue(report, readingCount, results);
+    EtherEventQueue.flushQueue();
+  }
+  printResult(F("queue() batch"), micros() - timestamp);
+}
+
+
+void loop() {}
+
+
+void printResult(const __FlashStringHelper* method, const unsigned long duration) {
+  Serial.print(method);
+  Serial.print(',');
+  Serial.print((unsigned long)reportCount * readingCount);
+  Serial.print(',');
+  Serial.print(duration);
+  Serial.print(',');
+  Serial.println(duration / reportCount);
+}
@@ -0,0 +1,300 @@
+// Example script for the EtherEventQueue library. Benchmarks the queue in typical usage scenarios and checks the results for regressions.
+// Each scenario is run with a virtual clock and a deterministic simulated network instead of Ethernet, so the throughput and latency results are the same on every board and every run. The results are compared to the baselines in baselines.h and REGRESSION is printed if a result is worse.
+// The real time taken by each scenario and the heap used by EtherEventQueue.begin() depend on the board and are printed but not compared.
+// To compare the code size of the configurations, uncomment the #define lines below one at a time and compare the sketch size reported by the compiler.
+// No Ethernet hardware or network is needed.
+
+//#define ETHEREVENT_NO_AUTHENTICATION
+//#define ETHEREVENT_FAST_SEND
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+#include "baselines.h"
+
+
+struct scenario_t {
+  const char* name;
+  unsigned int nodeCount;  //must be a power of 2. Events are queued to the nodes in turn.
+  byte eventType;
+  unsigned long eventInterval;  //(ms)virtual time between bursts of events
+  unsigned int burstSize;  //events per burst, 0 = no events. The events are queued as soon as there is room in the queue.
+  byte ackLossPercent;  //percentage of the ACKs of eventTypeConfirm events that are lost
+};
+
+const scenario_t scenarios[] = {
+  {"telemetry", 8, EtherEventQueue.eventTypeOnce, 100, 1, 0},  //steady stream of events to a few nodes
+  {"burst", 1, EtherEventQueue.eventTypeConfirm, 60000, 100, 0},  //bursts of events to one node
+  {"fan-out", 256, EtherEventQueue.eventTypeOnce, 10000, 256, 0},  //an event to every node
+  {"confirm with lossy ACKs", 16, EtherEventQueue.eventTypeConfirm, 50, 1, 20},  //eventTypeConfirm events with a high ACK loss rate
+  {"keepalive only", 64, EtherEventQueue.eventTypeOnce, 0, 0, 0},  //idle, only keepalives are sent
+};
+
+
+//configuration parameters - modify these values to your desired settings
+const unsigned long scenarioDuration = 10UL * 60 * 1000;  //(ms)virtual time to run each scenario
+const unsigned int stepDuration = 5;  //(ms)virtual time between loop iterations
+const byte queueSize = 20;
+const unsigned int ackLatencyMin = 5;  //(ms)minimum time for an ACK to arrive
+const unsigned int ackLatencyMax = 100;  //(ms)maximum time for an ACK to arrive
+const unsigned int port = 1024;
+
+
+const unsigned long virtualClockStart = 0UL - 5UL * 60 * 1000;  //5 minutes before the millis() rollover
+unsigned long virtualMillis;
+
+unsigned long virtualClock() {
+  return virtualMillis;
+}
+
+
+//xorshift pseudorandom number generator. Used instead of random() so the results don't depend on the board's random() implementation.
+unsigned long randomState;
+
+unsigned long benchmarkRandom(const unsigned long howBig) {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState % howBig;
+}
+
+
+//The simulated network accepts all sends and ACKs the eventTypeConfirm events after a random latency. The ACKs are delivered in the order the events were sent.
+class BenchmarkNetwork : public EtherEventQueueNetwork {
+  public:
+    unsigned long sendCount;
+    boolean ackEvents;  //ACK the events
+    byte ackLossPercent;
+
+    void reset() {
+      sendCount = 0;
+      ackHead = 0;
+      ackCount = 0;
+      receiving = false;
+    }
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)port;
+      sendCount++;
+      if (!ackEvents || strcmp(event, "event") != 0 || benchmarkRandom(100) < ackLossPercent || ackCount == ackBufferSize) {  //no ACK or the ACK was lost
+        return 1;
+      }
+      ack_t &ack = ackBuffer[(ackHead + ackCount) % ackBufferSize];
+      ack.deliveryTimestamp = virtualMillis + ackLatencyMin + benchmarkRandom(ackLatencyMax - ackLatencyMin + 1);
+      ack.IP = IPAddress(targetIP[0], targetIP[1], targetIP[2], targetIP[3]);
+      ack.eventID[0] = payload[0];
+      ack.eventID[1] = payload[1];
+      ackCount++;
+      return 1;
+    }
+
+    byte availableEvent() {
+      if (receiving) {  //discard the previous ACK the same as EtherEvent discards an event that was not read
+        ackHead = (ackHead + 1) % ackBufferSize;
+        ackCount--;
+        receiving = false;
+      }
+      if (ackCount == 0 || (long)(virtualMillis - ackBuffer[ackHead].deliveryTimestamp) < 0) {  //no ACK has arrived yet
+        return 0;
+      }
+      receiving = true;
+      return sizeof("ack");
+    }
+
+    void readEvent(char eventBuffer[]) {
+      strcpy(eventBuffer, "ack");
+    }
+
+    unsigned int availablePayload() {
+      return 5;  //eventID of the ACK + eventID of the event + null terminator
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      payloadBuffer[0] = '1';  //the eventID of the ACK itself is not used
+      payloadBuffer[1] = '0';
+      payloadBuffer[2] = ackBuffer[ackHead].eventID[0];
+      payloadBuffer[3] = ackBuffer[ackHead].eventID[1];
+      payloadBuffer[4] = 0;
+    }
+
+    void flushReceiver() {}
+
+    IPAddress senderIP() {
+      return ackBuffer[ackHead].IP;
+    }
+
+  private:
+    static const byte ackBufferSize = 64;
+    struct ack_t {
+      unsigned long deliveryTimestamp;
+      IPAddress IP;
+      char eventID[2];
+    };
+    ack_t ackBuffer[ackBufferSize];
+    byte ackHead;
+    byte ackCount;
+    boolean receiving;
+};
+
+
+BenchmarkNetwork benchmarkNetwork;
+EthernetClient ethernetClient;  //not used by the simulated network
+EthernetServer ethernetServer(port);  //not used by the simulated network
+long freeMemoryStart;
+byte regressionCount;
+
+
+void setup() {
+  Serial.begin(9600);
+  freeMemoryStart = freeMemory();
+  EtherEventQueue.setClock(virtualClock);  //must be set before begin() so the node timestamps use the virtual clock
+  EtherEventQueue.setNetwork(benchmarkNetwork);
+
+  Serial.print(F("configuration:"));
+#ifdef ETHEREVENT_NO_AUTHENTICATION
+  Serial.print(F(" ETHEREVENT_NO_AUTHENTICATION"));
+#endif
+#ifdef ETHEREVENT_FAST_SEND
+  Serial.print(F(" ETHEREVENT_FAST_SEND"));
+#endif
+  Serial.println();
+  Serial.println(F("scenario,completed,sends,events/s,latency p50(ms),latency p99(ms),heap(bytes),real time(ms),result"));
+  for (byte scenarioCount = 0; scenarioCount < sizeof(scenarios) / sizeof(scenarios[0]); scenarioCount++) {
+    runScenario(scenarios[scenarioCount], baselines[scenarioCount]);
+  }
+  Serial.print(F("regressions: "));
+  Serial.println(regressionCount);
+}
+
+
+void loop() {}
+
+
+void runScenario(const scenario_t &scenario, const baseline_t &baseline) {
+  virtualMillis = virtualClockStart;
+  randomState = 1;
+  benchmarkNetwork.reset();
+  benchmarkNetwork.ackEvents = scenario.eventType == EtherEventQueue.eventTypeConfirm;
+  benchmarkNetwork.ackLossPercent = scenario.ackLossPercent;
+  if (EtherEventQueue.begin(0, scenario.nodeCount + 1, queueSize, 10, 10, 10, 10) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+  const long heap = freeMemoryStart - freeMemory();
+  EtherEventQueue.setNodeRange(1, IPAddress(10, 0, 0, 0), 32 - log2Count(scenario.nodeCount));  //node n is the nth address of the subnet
+  EtherEventQueue.setEventAck(F("ack"));
+  EtherEventQueue.setEventKeepalive(F("keepalive"));
+  EtherEventQueue.setResendDelay(250);
+  EtherEventQueue.setLatencyHistogram(true);
+  EtherEventQueue.resetStats();
+
+  const unsigned long startTimestamp = millis();
+  unsigned long eventTimestamp = virtualMillis - scenario.eventInterval;  //the first burst is queued immediately
+  unsigned int pendingCount = 0;  //events of the current bursts that have not been queued yet
+  unsigned int targetNode = 0;
+  unsigned long eventCount = 0;
+  while (virtualMillis - virtualClockStart < scenarioDuration) {
+    virtualMillis += stepDuration;
+    if (scenario.burstSize > 0 && virtualMillis - eventTimestamp >= scenario.eventInterval) {
+      eventTimestamp += scenario.eventInterval;
+      pendingCount += scenario.burstSize;
+    }
+    while (pendingCount > 0 && EtherEventQueue.getQueueSize() < queueSize) {
+      EtherEventQueue.queue(1 + targetNode, port, scenario.eventType, F("event"), eventCount);
+      eventCount++;
+      targetNode = (targetNode + 1) % scenario.nodeCount;
+      pendingCount--;
+    }
+    EtherEventQueue.sendKeepalive(port);
+    EtherEventQueue.queueHandler(ethernetClient);
+    while (EtherEventQueue.availableEvent(ethernetServer) > 0) {  //the benchmark only receives ACKs, which are handled by EtherEventQueue
+      EtherEventQueue.flushReceiver();
+    }
+  }
+  const unsigned long realTime = millis() - startTimestamp;
+
+  const byte histogram = scenario.eventType == EtherEventQueue.eventTypeConfirm ? EtherEventQueue.latencyHistogramAck : EtherEventQueue.latencyHistogramSend;
+  unsigned long completed = 0;
+  for (byte bucket = 0; bucket < EtherEventQueue.latencyHistogramBucketCount; bucket++) {
+    completed += EtherEventQueue.getLatencyHistogram(histogram, bucket);
+  }
+  const unsigned long latencyP50 = latencyPercentile(histogram, completed, 50);
+  const unsigned long latencyP99 = latencyPercentile(histogram, completed, 99);
+
+  Serial.print(scenario.name);
+  Serial.print(',');
+  Serial.print(completed);
+  Serial.print(',');
+  Serial.print(benchmarkNetwork.sendCount);
+  Serial.print(',');
+  Serial.print((float)completed * 1000 / scenarioDuration);
+  Serial.print(',');
+  Serial.print(latencyP50);
+  Serial.print(',');
+  Serial.print(latencyP99);
+  Serial.print(',');
+  if (freeMemoryStart < 0) {
+    Serial.print(F("unknown"));
+  }
+  else {
+    Serial.print(heap);
+  }
+  Serial.print(',');
+  Serial.print(realTime);
+  Serial.print(',');
+  if (completed * 100 < baseline.completed * (100 - regressionTolerancePercent) || benchmarkNetwork.sendCount * 100 > baseline.sends * (100 + regressionTolerancePercent) || latencyP50 > baseline.latencyP50 || latencyP99 > baseline.latencyP99) {
+    Serial.println(F("REGRESSION"));
+    regressionCount++;
+  }
+  else {
+    Serial.println(F("OK"));
+  }
+}
+
+
+//returns the upper bound(ms) of the latency histogram bucket that holds the given percentile of the events
+unsigned long latencyPercentile(const byte histogram, const unsigned long total, const byte percentile) {
+  const unsigned long rank = (total * percentile + 99) / 100;  //number of events at or below the percentile, rounded up
+  unsigned long count = 0;
+  for (byte bucket = 0; bucket < EtherEventQueue.latencyHistogramBucketCount; bucket++) {
+    count += EtherEventQueue.getLatencyHistogram(histogram, bucket);
+    if (count >= rank) {
+      return (1UL << bucket) - 1;  //bucket n holds latencies up to 2^n - 1 ms
+    }
+  }
+  return 0;  //no events
+}
+
+
+//returns the number of bits needed to address count nodes
+byte log2Count(unsigned int count) {
+  byte bits = 0;
+  while (count > 1) {
+    count >>= 1;
+    bits++;
+  }
+  return bits;
+}
+
+
+//returns the free memory(bytes) or -1 if not supported on this board
+#if defined(__AVR__)
+extern char* __brkval;
+extern char __heap_start;
+
+long freeMemory() {
+  char top;
+  return &top - (__brkval == 0 ? &__heap_start : __brkval);
+}
+#elif defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+long freeMemory() {
+  return ESP.getFreeHeap();
+}
+#else
+long freeMemory() {
+  return -1;
+}
+#endif
@@ -0,0 +1,25 @@
+// Baseline results of the Benchmark example. The Benchmark example compares its results to these values and prints REGRESSION if a result is worse.
+// The results are measured in virtual time with a deterministic simulated network so they are the same on every board. After an intended change of the queue behavior run the Benchmark example and replace these values with the new results.
+// The order of the entries must match the order of the scenarios in Benchmark.ino.
+
+#ifndef baselines_h
+#define baselines_h
+
+struct baseline_t {
+  unsigned long completed;  //events sent(eventTypeOnce) or ACKed(eventTypeConfirm)
+  unsigned long sends;  //sends made to the network, including keepalives and resends
+  unsigned long latencyP50;  //(ms)upper bound of the latency histogram bucket holding the median
+  unsigned long latencyP99;  //(ms)upper bound of the latency histogram bucket holding the 99th percentile
+};
+
+const baseline_t baselines[] = {
+  {6001, 6001, 0, 0},  //telemetry
+  {1000, 1020, 127, 255},  //burst
+  {15361, 15361, 127, 127},  //fan-out
+  {8288, 10658, 127, 65535},  //confirm with lossy ACKs
+  {27, 122, 31, 2047},  //keepalive only
+};
+
+const byte regressionTolerancePercent = 2;  //allowed decrease of completed and increase of sends before a result is a regression
+
+#endif
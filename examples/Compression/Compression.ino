@@ -0,0 +1,121 @@
+// Example script for the EtherEventQueue library. Demonstrates payload compression and benchmarks its size and speed.
+// Representative payloads are queued with compression disabled and enabled and sent through a loopback network that passes them straight back to EtherEventQueue.availableEvent(), so both the compression in EtherEventQueue.queue() and the decompression are measured.
+// For each payload the length, the length sent on the network, the time taken by EtherEventQueue.queue() and EtherEventQueue.availableEvent() and whether the received payload matches are printed to the serial monitor.
+// No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const unsigned int sendPayloadLengthMax = 160;  //compressed payloads have to fit in the queue buffer
+const unsigned int payloadLengthMax = 300;  //maximum uncompressed payload length
+const unsigned int port = 1024;
+const IPAddress targetIP(192, 168, 69, 105);  //not used by the loopback network
+
+
+//The loopback network receives every event it sends.
+class LoopbackNetwork : public EtherEventQueueNetwork {
+  public:
+    unsigned int sentPayloadLength;  //the length of the last payload sent, including the eventID
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)targetIP;
+      (void)port;
+      strncpy(eventBuffer, event, sizeof(eventBuffer) - 1);
+      strncpy(payloadBuffer, payload, sizeof(payloadBuffer) - 1);
+      sentPayloadLength = strlen(payload);
+      pending = true;
+      return 1;
+    }
+
+    byte availableEvent() {
+      return pending ? strlen(eventBuffer) + 1 : 0;
+    }
+
+    void readEvent(char buffer[]) {
+      strcpy(buffer, eventBuffer);
+    }
+
+    unsigned int availablePayload() {
+      return strlen(payloadBuffer) + 1;
+    }
+
+    void readPayload(char buffer[]) {
+      strcpy(buffer, payloadBuffer);
+    }
+
+    void flushReceiver() {
+      pending = false;
+    }
+
+  private:
+    char eventBuffer[10];
+    char payloadBuffer[sendPayloadLengthMax + 10];  //the payload buffer has room for the eventID
+    boolean pending;
+};
+
+
+LoopbackNetwork loopbackNetwork;
+EthernetClient ethernetClient;  //not used by the loopback network
+EthernetServer ethernetServer(port);  //not used by the loopback network
+char payload[payloadLengthMax + 1];
+char receivedPayload[payloadLengthMax + 1];
+
+
+void setup() {
+  Serial.begin(9600);
+  EtherEventQueue.setNetwork(loopbackNetwork);
+  if (EtherEventQueue.begin(2, 10, sendPayloadLengthMax, 10, payloadLengthMax) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+
+  Serial.println(F("payload,length,compression,sent length,ratio(%),queue(us),availableEvent(us),match"));
+  benchmark(F("JSON status"), F("{\"device\":\"greenhouse-3\",\"uptime\":864523,\"temperature\":21.75,\"humidity\":48.2,\"relays\":[{\"id\":1,\"state\":\"on\"},{\"id\":2,\"state\":\"off\"},{\"id\":3,\"state\":\"off\"},{\"id\":4,\"state\":\"on\"}],\"status\":\"ok\"}"));
+  benchmark(F("CSV telemetry"), F("21.75,21.81,21.87,21.94,22.00,22.06,22.12,22.19,22.25,22.31,22.37,22.44,22.50,22.56,22.62,22.69,22.75,22.81,22.87,22.94"));
+  benchmark(F("log text"), F("sensor 3 read failed, retrying; sensor 3 read failed, retrying; sensor 3 read ok after 2 retries"));
+  benchmark(F("short"), F("relay 1 on"));
+  Serial.print(F("bytes saved: "));
+  Serial.println(EtherEventQueue.getStats().compressionSaved);
+}
+
+
+void loop() {}
+
+
+void benchmark(const __FlashStringHelper* name, const __FlashStringHelper* payloadFlash) {
+  strncpy_P(payload, (PGM_P)payloadFlash, payloadLengthMax);  //char array payloads are copied to the queue so the F() string reference doesn't bypass the compression
+  for (byte compression = 0; compression < 2; compression++) {
+    EtherEventQueue.setPayloadCompression(compression ? payloadLengthMax : 0);
+    unsigned long timestamp = micros();
+    EtherEventQueue.queue(targetIP, port, EtherEventQueue.eventTypeOnce, F("test"), payload);
+    const unsigned long queueDuration = micros() - timestamp;
+    EtherEventQueue.queueHandler(ethernetClient);
+    timestamp = micros();
+    EtherEventQueue.availableEvent(ethernetServer);
+    const unsigned long availableEventDuration = micros() - timestamp;
+    EtherEventQueue.readPayload(receivedPayload);
+    EtherEventQueue.flushReceiver();
+
+    Serial.print(name);
+    Serial.print(',');
+    Serial.print(strlen(payload));
+    Serial.print(',');
+    Serial.print(compression ? F("on") : F("off"));
+    Serial.print(',');
+    Serial.print(loopbackNetwork.sentPayloadLength - 2);  //without the eventID
+    Serial.print(',');
+    Serial.print(100.0 * (loopbackNetwork.sentPayloadLength - 2) / strlen(payload));
+    Serial.print(',');
+    Serial.print(queueDuration);
+    Serial.print(',');
+    Serial.print(availableEventDuration);
+    Serial.print(',');
+    Serial.println(strcmp(payload, receivedPayload) == 0 ? F("yes") : F("no(truncated)"));
+  }
+}
@@ -0,0 +1,139 @@
+// Example script for the EtherEventQueue library. Demonstrates use of multiple independent queues.
+// A telemetry queue with a large payload buffer periodically queues a reading, a control queue with a small buffer and eventTypeConfirm events periodically queues a command. Each queue receives on its own port.
+// The time spent in each queue's functions is measured and printed to the serial monitor so the cost of running the instances side by side can be compared.
+// Use with the EventGhost-example-trees.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const boolean useDHCP = false;  //true==use DHCP to assign an IP address to the device, this will significantly increase memory usage. false==use static IP address.
+byte MACaddress[] = {0, 1, 2, 3, 4, 4};  //this can be anything you like, but must be unique on your network
+const IPAddress deviceIP = IPAddress(192, 168, 69, 104);  //IP address to use for the device. This can be any valid address on the network as long as it is unique. If you are using DHCP then this doesn't need to be configured.
+const char password[] = "password";  //EtherEvent password. This must match the password set in EventGhost.
+const unsigned int telemetryPort = 1024;  //TCP port to receive telemetry events
+const unsigned int controlPort = 1025;  //TCP port to receive control events
+
+const unsigned int telemetryInterval = 4000;  //(ms)Delay between queueing the telemetry events.
+const unsigned int controlInterval = 10000;  //(ms)Delay between queueing the control events.
+const unsigned long benchmarkInterval = 30000;  //(ms)Delay between printing the timing results.
+const IPAddress sendIP = IPAddress(192, 168, 69, 100);  //The IP address to send the test events to.
+
+
+EtherEventQueueClass telemetryQueue;  //the global EtherEventQueue instance is used for control events, additional instances are created like this
+EthernetServer telemetryServer(telemetryPort);
+EthernetServer controlServer(controlPort);
+EthernetClient ethernetClient;  //the client object can be shared by the instances
+unsigned long telemetryTimestamp;
+unsigned long controlTimestamp;
+unsigned long benchmarkTimestamp;
+
+//timing data for each instance
+struct benchmark_t {
+  unsigned long loopCount;
+  unsigned long durationTotal;  //(us)
+  unsigned long durationMax;  //(us)
+};
+benchmark_t telemetryBenchmark;
+benchmark_t controlBenchmark;
+
+
+void setup() {
+  Serial.begin(9600);  //the received event and other information will be displayed in your serial monitor while the sketch is running
+  if (useDHCP == true) {
+    Ethernet.begin(MACaddress);  //let the network assign an IP address
+  }
+  else {
+    Ethernet.begin(MACaddress, deviceIP);  //use static IP address
+  }
+  telemetryServer.begin();
+  controlServer.begin();
+  //each instance has its own buffers, eventIDs, nodes and settings
+  if (telemetryQueue.begin(3, 10, 60, 10, 10) == false || EtherEventQueue.begin(5, 10, 10, 10, 30) == false || EtherEvent.setPassword(password) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (1);  //abort execution of the rest of the program
+  }
+  telemetryQueue.setResendDelay(5000);
+  EtherEventQueue.setEventAck(F("ack"));
+  EtherEventQueue.setResendDelay(2000);
+}
+
+
+void loop() {
+  unsigned long startTimestamp = micros();
+  handleQueue(telemetryQueue, telemetryServer, F("telemetry"));
+  benchmarkRecord(telemetryBenchmark, micros() - startTimestamp);
+
+  startTimestamp = micros();
+  handleQueue(EtherEventQueue, controlServer, F("control"));
+  benchmarkRecord(controlBenchmark, micros() - startTimestamp);
+
+  if (millis() - telemetryTimestamp > telemetryInterval) {
+    telemetryTimestamp = millis();
+    telemetryQueue.queue(sendIP, telemetryPort, telemetryQueue.eventTypeOnce, F("telemetry"), analogRead(A0));
+  }
+
+  if (millis() - controlTimestamp > controlInterval) {
+    controlTimestamp = millis();
+    EtherEventQueue.queue(sendIP, controlPort, EtherEventQueue.eventTypeConfirm, F("control"), F("on"));
+  }
+
+  if (millis() - benchmarkTimestamp > benchmarkInterval) {
+    benchmarkTimestamp = millis();
+    benchmarkPrint(telemetryBenchmark, F("telemetry"));
+    benchmarkPrint(controlBenchmark, F("control"));
+  }
+
+  if (useDHCP == true) {
+    Ethernet.maintain();  //request renewal of DHCP lease if expired
+  }
+}
+
+
+void handleQueue(EtherEventQueueClass &queue, EthernetServer &ethernetServer, const __FlashStringHelper* name) {
+  if (queue.queueHandler(ethernetClient) == false) {  //this will send events from the queue
+    Serial.print(F("\nEvent send failed: "));
+    Serial.println(name);
+  }
+
+  if (byte length = queue.availableEvent(ethernetServer)) {  //this checks for a new event and gets the length of the event including the null terminator
+    char event[length];
+    queue.readEvent(event);
+    length = queue.availablePayload();
+    char payload[length];
+    queue.readPayload(payload);
+    Serial.print(F("\nReceived "));
+    Serial.print(name);
+    Serial.print(F(" event: "));
+    Serial.print(event);
+    Serial.print(F(", payload: "));
+    Serial.println(payload);
+  }
+}
+
+
+void benchmarkRecord(benchmark_t &benchmark, const unsigned long duration) {
+  benchmark.loopCount++;
+  benchmark.durationTotal += duration;
+  if (duration > benchmark.durationMax) {
+    benchmark.durationMax = duration;
+  }
+}
+
+
+void benchmarkPrint(benchmark_t &benchmark, const __FlashStringHelper* name) {
+  Serial.print(F("\n"));
+  Serial.print(name);
+  Serial.print(F(" queue: average(us)="));
+  Serial.print(benchmark.loopCount > 0 ? benchmark.durationTotal / benchmark.loopCount : 0);
+  Serial.print(F(", max(us)="));
+  Serial.println(benchmark.durationMax);
+  benchmark.loopCount = 0;
+  benchmark.durationTotal = 0;
+  benchmark.durationMax = 0;
+}
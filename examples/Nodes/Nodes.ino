@@ -100,7 +100,7 @@ void loop() {
     IPAddress receivedIP = EtherEvent.senderIP();
     Serial.print(F("Received from IP address: "));
     Serial.println(receivedIP);
-    int8_t receivedNode = EtherEventQueue.getNode(receivedIP);
+    int receivedNode = EtherEventQueue.getNode(receivedIP);
     if (receivedNode != -1) {  //-1 indicates no matching node
       Serial.print(F("Received from node: "));
       Serial.println(receivedNode);
@@ -137,13 +137,13 @@ void loop() {
     sendTimestamp = millis();  //reset the timestamp for the next event send
   }
 
-  int8_t timedOutNode = EtherEventQueue.checkTimeout();
+  int timedOutNode = EtherEventQueue.checkTimeout();
   if (timedOutNode != -1) {  //-1 indicates no nodes are newly timed out
     Serial.print(F("\nNewly timed out node: "));
     Serial.println(timedOutNode);
   }
 
-  int8_t timedInNode = EtherEventQueue.checkTimein();
+  int timedInNode = EtherEventQueue.checkTimein();
   if (timedInNode != -1) {  //-1 indicates no nodes are newly timed in
     Serial.print(F("\nNewly timed in node: "));
     Serial.println(timedInNode);
@@ -0,0 +1,150 @@
+// Example script for the EtherEventQueue library. Demonstrates EtherEventQueue.setReceivePoll() with several senders connecting at the same time.
+// A simulated server has a ready connection from each of clientCount senders, some with keepalives and the rest with events for the sketch. Like EtherEvent, the server keeps the event of the current connection until it is flushed and only then accepts the next connection.
+// With the default of one connection per EtherEventQueue.availableEvent() call the senders have to wait for the following calls. With setReceivePoll(clientCount) and a receive buffer all the connections are serviced in the first call.
+// The number of connections serviced by the first call and the number of events received are printed to the serial monitor for each setting, followed by a check that every event was received exactly once.
+// No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const byte clientCount = 4;  //the number of sockets of the W5100(MAX_SOCK_NUM)
+const byte keepaliveInterval = 3;  //every keepaliveInterval-th sender sends a keepalive, which is handled by EtherEventQueue
+const byte eventLengthMax = 10;
+const unsigned int payloadLengthMax = 10;
+const unsigned int port = 1024;
+
+
+//The simulated server has a ready connection from each sender. The event of the current connection is kept until flushReceiver() is called, the same as EtherEvent.
+class SimulatedServer : public EtherEventQueueNetwork {
+  public:
+    byte acceptedCount;  //the number of connections accepted
+
+    void connect() {
+      pendingCount = clientCount;
+      current = -1;
+      acceptedCount = 0;
+    }
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)targetIP;
+      (void)port;
+      (void)event;
+      (void)payload;
+      return 1;
+    }
+
+    byte availableEvent() {
+      if (current < 0) {  //no connection is being serviced
+        if (pendingCount == 0) {
+          return 0;
+        }
+        current = clientCount - pendingCount;  //accept the next connection
+        pendingCount--;
+        acceptedCount++;
+      }
+      return strlen(eventGet()) + 1;
+    }
+
+    void readEvent(char eventBuffer[]) {
+      strcpy(eventBuffer, eventGet());
+    }
+
+    unsigned int availablePayload() {
+      return 4;  //eventID + the sender number + null terminator
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      payloadBuffer[0] = '1';  //the eventID is 10 + the sender number
+      payloadBuffer[1] = '0' + current;
+      payloadBuffer[2] = '0' + current;  //the payload is the sender number
+      payloadBuffer[3] = 0;
+    }
+
+    void flushReceiver() {
+      current = -1;  //the next connection can be accepted
+    }
+
+  private:
+    byte pendingCount;  //the number of connections waiting to be accepted
+    int8_t current;  //the sender of the connection being serviced, -1 = none
+
+    const char* eventGet() {
+      return current % keepaliveInterval == keepaliveInterval - 1 ? "keepalive" : "event";
+    }
+};
+
+
+SimulatedServer simulatedServer;
+EthernetServer ethernetServer(port);  //not used by the simulated server
+
+
+void setup() {
+  Serial.begin(9600);
+  EtherEventQueue.setNetwork(simulatedServer);
+  if (EtherEventQueue.begin(1, eventLengthMax, payloadLengthMax, eventLengthMax, payloadLengthMax) == false || EtherEventQueue.setReceiveBuffer(clientCount * (4 + eventLengthMax + payloadLengthMax)) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+  EtherEventQueue.setEventKeepalive(F("keepalive"));
+
+  Serial.println(F("receivePoll,connections,serviced by the first call,events received"));
+  const boolean defaultPassed = receiveTest(1);
+  const boolean pollPassed = receiveTest(clientCount);
+  if (defaultPassed && pollPassed) {
+    Serial.println(F("PASS"));
+  }
+  else {
+    Serial.println(F("FAIL"));
+  }
+}
+
+
+void loop() {}
+
+
+//all senders connect at the same time. Returns true if every event was received exactly once and the poll setting serviced as many connections in the first call as it allows.
+boolean receiveTest(const byte receivePoll) {
+  EtherEventQueue.setReceivePoll(receivePoll);
+  simulatedServer.connect();
+  byte receivedCount[clientCount] = {0};
+  byte receivedTotal = 0;
+  byte firstCallCount = 0;
+  for (byte call = 0; call < clientCount * 2; call++) {
+    if (EtherEventQueue.availableEvent(ethernetServer) > 0) {
+      char payload[payloadLengthMax + 1];
+      EtherEventQueue.readPayload(payload);
+      const byte sender = payload[0] - '0';
+      if (sender < clientCount) {
+        receivedCount[sender]++;
+      }
+      receivedTotal++;
+      EtherEventQueue.flushReceiver();
+    }
+    if (call == 0) {
+      firstCallCount = simulatedServer.acceptedCount;
+    }
+  }
+
+  Serial.print(receivePoll);
+  Serial.print(',');
+  Serial.print(clientCount);
+  Serial.print(',');
+  Serial.print(firstCallCount);
+  Serial.print(',');
+  Serial.println(receivedTotal);
+
+  boolean passed = simulatedServer.acceptedCount == clientCount && firstCallCount == min(receivePoll, clientCount);
+  for (byte sender = 0; sender < clientCount; sender++) {
+    const boolean keepalive = sender % keepaliveInterval == keepaliveInterval - 1;
+    if (receivedCount[sender] != (keepalive ? 0 : 1)) {
+      passed = false;
+    }
+  }
+  return passed;
+}
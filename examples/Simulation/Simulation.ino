@@ -0,0 +1,226 @@
+// Example script for the EtherEventQueue library. Demonstrates a deterministic simulation of a large network using a virtual clock and a simulated network instead of Ethernet.
+// The device sends eventTypeConfirm events to random virtual nodes. The virtual nodes ACK the events after a random latency. Events and ACKs are lost at a configurable rate and some of the virtual nodes are cut off from the network for a while.
+// The virtual clock starts shortly before the millis() rollover so the timing is tested across it. Hours of network time are simulated in seconds and the results are printed to the serial monitor.
+// No Ethernet hardware or network is needed. The simulation uses about 50 bytes of SRAM per virtual node, reduce virtualNodeCount for boards with less memory.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const unsigned int virtualNodeCount = 1024;  //must be a power of 2. The virtual nodes are the addresses of the 10.0.0.0 subnet of this size.
+const unsigned long simulationDuration = 2UL * 60 * 60 * 1000;  //(ms)virtual time to simulate
+const unsigned int stepDuration = 5;  //(ms)virtual time between loop iterations
+const unsigned int eventInterval = 50;  //(ms)virtual time between queueing events to random virtual nodes
+const unsigned int latencyMin = 5;  //(ms)minimum time for an ACK to arrive
+const unsigned int latencyMax = 200;  //(ms)maximum time for an ACK to arrive
+const byte lossPercent = 2;  //percentage of events and ACKs that are lost
+const unsigned int partitionNodeCount = 64;  //the first partitionNodeCount virtual nodes can't be reached during the partition
+const unsigned long partitionStart = 30UL * 60 * 1000;  //(ms)virtual time from the start of the simulation to the start of the partition
+const unsigned long partitionDuration = 10UL * 60 * 1000;  //(ms)
+const unsigned long reportInterval = 15UL * 60 * 1000;  //(ms)virtual time between printing the results
+const long randomSeedValue = 1;  //the same seed always gives the same results
+const unsigned int port = 1024;
+
+
+const unsigned long virtualClockStart = 0UL - 10UL * 60 * 1000;  //10 minutes before the millis() rollover
+unsigned long virtualMillis = virtualClockStart;
+
+unsigned long virtualClock() {
+  return virtualMillis;
+}
+
+
+//The simulated network delivers the events sent by EtherEventQueue to the virtual nodes and returns their ACKs. The ACKs are delivered in the order the events were sent.
+class SimulatedNetwork : public EtherEventQueueNetwork {
+  public:
+    unsigned long sendCount;
+    unsigned long sendFailedCount;  //sends to partitioned virtual nodes
+    unsigned long deliveredCount;  //events received by the virtual nodes, including duplicates caused by lost ACKs
+    unsigned long lostCount;  //events and ACKs lost
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)port;
+      sendCount++;
+      const unsigned int node = (((unsigned int)targetIP[2] << 8) | targetIP[3]) & (virtualNodeCount - 1);
+      if (partitioned(node)) {
+        sendFailedCount++;
+        return 0;  //the connection failed
+      }
+      if (random(100) < lossPercent) {  //the event was lost after it was sent
+        lostCount++;
+        return 1;
+      }
+      deliveredCount++;
+      if (strcmp(event, "event") != 0) {  //only events are ACKed, not keepalives
+        return 1;
+      }
+      if (random(100) < lossPercent || ackCount == ackBufferSize) {  //the ACK was lost
+        lostCount++;
+        return 1;
+      }
+      ack_t &ack = ackBuffer[(ackHead + ackCount) % ackBufferSize];
+      ack.deliveryTimestamp = virtualMillis + random(latencyMin, latencyMax + 1);
+      ack.IP = IPAddress(targetIP[0], targetIP[1], targetIP[2], targetIP[3]);
+      ack.eventID[0] = payload[0];
+      ack.eventID[1] = payload[1];
+      ackCount++;
+      return 1;
+    }
+
+    byte availableEvent() {
+      if (receiving) {  //discard the previous ACK the same as EtherEvent discards an event that was not read
+        ackHead = (ackHead + 1) % ackBufferSize;
+        ackCount--;
+        receiving = false;
+      }
+      if (ackCount == 0 || (long)(virtualMillis - ackBuffer[ackHead].deliveryTimestamp) < 0) {  //no ACK has arrived yet
+        return 0;
+      }
+      receiving = true;
+      return sizeof("ack");
+    }
+
+    void readEvent(char eventBuffer[]) {
+      strcpy(eventBuffer, "ack");
+    }
+
+    unsigned int availablePayload() {
+      return 5;  //eventID of the ACK + eventID of the event + null terminator
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      payloadBuffer[0] = '1';  //the eventID of the ACK itself is not used
+      payloadBuffer[1] = '0';
+      payloadBuffer[2] = ackBuffer[ackHead].eventID[0];
+      payloadBuffer[3] = ackBuffer[ackHead].eventID[1];
+      payloadBuffer[4] = 0;
+    }
+
+    void flushReceiver() {}
+
+    IPAddress senderIP() {
+      return ackBuffer[ackHead].IP;
+    }
+
+  private:
+    static const byte ackBufferSize = 64;
+    struct ack_t {
+      unsigned long deliveryTimestamp;
+      IPAddress IP;
+      char eventID[2];
+    };
+    ack_t ackBuffer[ackBufferSize];
+    byte ackHead;
+    byte ackCount;
+    boolean receiving;
+
+    boolean partitioned(const unsigned int node) {
+      const unsigned long simulationTime = virtualMillis - virtualClockStart;
+      return node < partitionNodeCount && simulationTime >= partitionStart && simulationTime - partitionStart < partitionDuration;
+    }
+};
+
+
+SimulatedNetwork simulatedNetwork;
+EthernetClient ethernetClient;  //not used by the simulated network
+EthernetServer ethernetServer(port);  //not used by the simulated network
+unsigned long queuedCount;  //events queued by the simulation
+unsigned long rejectedCount;  //events that couldn't be queued because the virtual node was timed out
+unsigned long queueSizeTotal;  //sum of the queue size at each step, used to calculate the average
+unsigned long stepCount;
+unsigned long startTimestamp;  //(ms)real time
+
+
+void setup() {
+  Serial.begin(9600);
+  randomSeed(randomSeedValue);
+  EtherEventQueue.setClock(virtualClock);  //must be set before begin() so the node timestamps use the virtual clock
+  EtherEventQueue.setNetwork(simulatedNetwork);
+  if (EtherEventQueue.begin(0, virtualNodeCount + 1, 20, 10, 10, 10, 10) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+  EtherEventQueue.setNodeRange(1, IPAddress(10, 0, 0, 0), 32 - log2Count(virtualNodeCount));  //virtual node n is node n + 1
+  EtherEventQueue.setEventAck(F("ack"));
+  EtherEventQueue.setEventKeepalive(F("keepalive"));
+  EtherEventQueue.setResendDelay(250);
+
+  Serial.println(F("time(s),queued,rejected,sends,send failed,delivered,lost,ACKed,delivery ratio(%),events/s,average queue size,queue size high water,real time(ms)"));
+  startTimestamp = millis();
+  unsigned long eventTimestamp = virtualMillis;
+  unsigned long reportTimestamp = virtualMillis;
+  while (virtualMillis - virtualClockStart < simulationDuration) {
+    virtualMillis += stepDuration;
+    if (virtualMillis - eventTimestamp >= eventInterval) {
+      eventTimestamp += eventInterval;
+      if (EtherEventQueue.queue(1 + (unsigned int)random(virtualNodeCount), port, EtherEventQueue.eventTypeConfirm, F("event"), queuedCount)) {
+        queuedCount++;
+      }
+      else {
+        rejectedCount++;
+      }
+    }
+    EtherEventQueue.sendKeepalive(port);
+    EtherEventQueue.queueHandler(ethernetClient);
+    while (EtherEventQueue.availableEvent(ethernetServer) > 0) {  //the simulation only receives ACKs, which are handled by EtherEventQueue
+      EtherEventQueue.flushReceiver();
+    }
+    queueSizeTotal += EtherEventQueue.getQueueSize();
+    stepCount++;
+    if (virtualMillis - reportTimestamp >= reportInterval) {
+      reportTimestamp = virtualMillis;
+      report();
+    }
+  }
+  report();
+}
+
+
+void loop() {}
+
+
+void report() {
+  const EtherEventQueueClass::stats_t &stats = EtherEventQueue.getStats();
+  const unsigned long simulationSeconds = (virtualMillis - virtualClockStart) / 1000;
+  Serial.print(simulationSeconds);
+  Serial.print(',');
+  Serial.print(queuedCount);
+  Serial.print(',');
+  Serial.print(rejectedCount);
+  Serial.print(',');
+  Serial.print(simulatedNetwork.sendCount);
+  Serial.print(',');
+  Serial.print(simulatedNetwork.sendFailedCount);
+  Serial.print(',');
+  Serial.print(simulatedNetwork.deliveredCount);
+  Serial.print(',');
+  Serial.print(simulatedNetwork.lostCount);
+  Serial.print(',');
+  Serial.print(stats.ackMatched);
+  Serial.print(',');
+  Serial.print(queuedCount > 0 ? 100.0 * stats.ackMatched / queuedCount : 0.0);
+  Serial.print(',');
+  Serial.print(simulationSeconds > 0 ? (float)stats.ackMatched / simulationSeconds : 0.0);
+  Serial.print(',');
+  Serial.print(stepCount > 0 ? (float)queueSizeTotal / stepCount : 0.0);
+  Serial.print(',');
+  Serial.print(stats.queueSizeHighWater);
+  Serial.print(',');
+  Serial.println(millis() - startTimestamp);
+}
+
+
+//returns the number of bits needed to address count nodes
+byte log2Count(unsigned int count) {
+  byte bits = 0;
+  while (count > 1) {
+    count >>= 1;
+    bits++;
+  }
+  return bits;
+}
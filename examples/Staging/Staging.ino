@@ -0,0 +1,188 @@
+// Example script for the EtherEventQueue library. Demonstrates EtherEventQueue.queueStaged() and stress tests the lock-free staging queue.
+// A producer thread stages events as fast as it can while the main program moves them to the queue and sends them with EtherEventQueue.queueHandler(). The producer reuses one buffer for its char array strings, so an event that was not copied when it was staged would be sent with the contents of a later event.
+// The events are sent to a simulated network that checks that every staged event arrives exactly once, in the order it was staged and with intact event and payload.
+// The number of events, the check results and the number of times the staging queue was full are printed to the serial monitor.
+// Requires POSIX threads: ESP32 or Linux. On the other boards call EtherEventQueue.queueStaged() from an interrupt handler instead. No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const unsigned long eventCount = 20000;
+const byte stagingSlotCount = 8;  //small so the producer fills the staging queue often
+const byte stringLengthMax = 20;
+const byte queueSizeMax = 4;
+const byte eventLengthMax = 10;
+const unsigned int payloadLengthMax = 30;
+const unsigned int port = 1024;
+const IPAddress targetIP(192, 168, 69, 105);  //not used by the simulated network
+const unsigned long stallTimeout = 10000;  //(ms)the test fails if no event arrives for this long
+
+
+//the event and payload staged for each sequence number, the producer and the simulated network build them the same way
+void eventBuild(const unsigned long sequence, char event[], char payload[]) {
+  switch (sequence % 3) {
+    case 0:  //char array string, copied when staged
+      sprintf(event, "text%u", (unsigned int)(sequence % 10));
+      break;
+    case 1:  //F() string, the pointer is staged
+      strcpy(event, "flash");
+      break;
+    default:  //number, converted when queued
+      sprintf(event, "%u", (unsigned int)(sequence % 1000));
+  }
+  //the sequence number followed by a pattern of varying length up to stringLengthMax
+  byte length = sprintf(payload, "%lu-", sequence);
+  const byte lengthTarget = length + sequence % (stringLengthMax - length + 1);
+  while (length < lengthTarget) {
+    payload[length] = 'a' + (sequence + length) % 26;
+    length++;
+  }
+  payload[length] = 0;
+}
+
+
+//The simulated network checks each event that is sent.
+class CheckNetwork : public EtherEventQueueNetwork {
+  public:
+    unsigned long nextSequence;  //the sequence number of the next event that must arrive
+    unsigned long duplicateCount;
+    unsigned long missingCount;
+    unsigned long corruptCount;
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)targetIP;
+      (void)port;
+      payload += 2;  //the first 2 characters are the eventID
+      const unsigned long sequence = strtoul(payload, NULL, 10);
+      if (sequence < nextSequence) {  //sent again
+        duplicateCount++;
+        return 1;
+      }
+      if (sequence > nextSequence) {  //events were lost
+        missingCount += sequence - nextSequence;
+      }
+      char eventExpected[eventLengthMax + 1];
+      char payloadExpected[stringLengthMax + 1];
+      eventBuild(sequence, eventExpected, payloadExpected);
+      if (strcmp(event, eventExpected) != 0 || strcmp(payload, payloadExpected) != 0) {
+        corruptCount++;
+      }
+      nextSequence = sequence + 1;
+      return 1;
+    }
+
+    byte availableEvent() {
+      return 0;
+    }
+
+    void readEvent(char eventBuffer[]) {
+      eventBuffer[0] = 0;
+    }
+
+    unsigned int availablePayload() {
+      return 0;
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      payloadBuffer[0] = 0;
+    }
+
+    void flushReceiver() {}
+};
+
+
+CheckNetwork checkNetwork;
+EthernetClient ethernetClient;  //not used by the simulated network
+volatile unsigned long stagingFullCount;  //written by the producer thread
+
+
+void setup() {
+  Serial.begin(9600);
+  EtherEventQueue.setNetwork(checkNetwork);
+  if (EtherEventQueue.begin(queueSizeMax, eventLengthMax, payloadLengthMax, eventLengthMax, payloadLengthMax) == false || EtherEventQueue.setStagingQueue(stagingSlotCount, stringLengthMax) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+
+  pthread_t producerThread;
+  if (pthread_create(&producerThread, NULL, producer, NULL) != 0) {
+    Serial.println(F("ERROR: Producer thread could not be started."));
+    while (true);
+  }
+  unsigned long timestamp = millis();
+  unsigned long sequencePrevious = 0;
+  while (checkNetwork.nextSequence < eventCount && millis() - timestamp < stallTimeout) {
+    EtherEventQueue.queueHandler(ethernetClient);
+    if (checkNetwork.nextSequence != sequencePrevious) {
+      sequencePrevious = checkNetwork.nextSequence;
+      timestamp = millis();
+    }
+  }
+  pthread_join(producerThread, NULL);
+  for (byte counter = 0; counter < queueSizeMax; counter++) {  //anything sent after the last event is a duplicate
+    EtherEventQueue.queueHandler(ethernetClient);
+  }
+  if (checkNetwork.nextSequence < eventCount) {
+    checkNetwork.missingCount += eventCount - checkNetwork.nextSequence;
+  }
+
+  Serial.print(F("events="));
+  Serial.print(eventCount);
+  Serial.print(F(", duplicates="));
+  Serial.print(checkNetwork.duplicateCount);
+  Serial.print(F(", missing="));
+  Serial.print(checkNetwork.missingCount);
+  Serial.print(F(", corrupt="));
+  Serial.print(checkNetwork.corruptCount);
+  Serial.print(F(", staging queue full="));
+  Serial.println(stagingFullCount);
+  if (checkNetwork.duplicateCount == 0 && checkNetwork.missingCount == 0 && checkNetwork.corruptCount == 0) {
+    Serial.println(F("PASS"));
+  }
+  else {
+    Serial.println(F("FAIL"));
+  }
+}
+
+
+void loop() {}
+
+
+//the producer thread, the only caller of EtherEventQueue.queueStaged()
+void* producer(void* argument) {
+  (void)argument;
+  char event[eventLengthMax + 1];
+  char payload[stringLengthMax + 1];
+  for (unsigned long sequence = 0; sequence < eventCount; sequence++) {
+    eventBuild(sequence, event, payload);
+    while (true) {
+      boolean staged;
+      switch (sequence % 3) {
+        case 0:
+          staged = EtherEventQueue.queueStaged(targetIP, port, EtherEventQueue.eventTypeOnce, event, payload);
+          break;
+        case 1:
+          staged = EtherEventQueue.queueStaged(targetIP, port, EtherEventQueue.eventTypeOnce, F("flash"), payload);
+          break;
+        default:
+          staged = EtherEventQueue.queueStaged(targetIP, port, EtherEventQueue.eventTypeOnce, (unsigned int)(sequence % 1000), payload);
+      }
+      if (staged) {
+        break;
+      }
+      stagingFullCount++;
+      sched_yield();  //let the main program empty the staging queue
+    }
+    memset(event, '#', sizeof(event) - 1);  //overwrite the buffers, the staged event must have its own copy
+    memset(payload, '#', sizeof(payload) - 1);
+  }
+  return NULL;
+}
@@ -0,0 +1,157 @@
+// Example script for the EtherEventQueue library. Demonstrates storing the events that don't fit in the queue and replaying them after a reset.
+// The storage is a RAM buffer and the reset is simulated by calling EtherEventQueue.begin() again, so the example can be run without wearing the EEPROM. Replace EtherEventQueueRAM with EtherEventQueueEEPROM to keep the events through a real reset.
+// More eventTypeConfirm events are queued than fit in the queue, the rest are written to the storage. The device is reset before the events are sent so only the stored events are replayed. The replayed events are sent to a simulated node that doesn't ACK them, the device is reset again and the events that were not ACKed are replayed from the storage a second time. Finally the simulated node ACKs the events and they are removed from the storage.
+// The queue size and the number of stored events waiting to be replayed are printed to the serial monitor after each step.
+// No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+#include <EtherEventQueueRAM.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const byte queueSizeMax = 4;
+const byte eventCount = 10;  //the number of events queued, eventCount - queueSizeMax of them are stored
+const byte storageRecordCount = 8;
+const byte sendEventLengthMax = 10;
+const byte sendPayloadLengthMax = 10;
+const unsigned int port = 1024;
+const unsigned int targetNode = 1;
+const IPAddress targetIP(192, 168, 69, 105);  //not used, the events are sent to the simulated network
+
+
+//The simulated network delivers the events to a single simulated node, which ACKs them immediately when acking is true.
+class SimulatedNetwork : public EtherEventQueueNetwork {
+  public:
+    boolean acking;
+
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)targetIP;
+      (void)port;
+      Serial.print(F("sent: "));
+      Serial.print(event);
+      Serial.print(F(", payload: "));
+      Serial.println(payload + 2);  //the first 2 characters are the eventID
+      if (acking && ackCount < ackBufferSize && strcmp(event, "ack") != 0) {
+        ackBuffer[ackCount][0] = payload[0];
+        ackBuffer[ackCount][1] = payload[1];
+        ackCount++;
+      }
+      return 1;
+    }
+
+    byte availableEvent() {
+      if (receiving) {  //discard the previous ACK the same as EtherEvent discards an event that was not read
+        ackCount--;
+        memmove(ackBuffer[0], ackBuffer[1], ackCount * sizeof(ackBuffer[0]));
+        receiving = false;
+      }
+      if (ackCount == 0) {
+        return 0;
+      }
+      receiving = true;
+      return sizeof("ack");
+    }
+
+    void readEvent(char eventBuffer[]) {
+      strcpy(eventBuffer, "ack");
+    }
+
+    unsigned int availablePayload() {
+      return 5;  //eventID of the ACK + eventID of the event + null terminator
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      payloadBuffer[0] = '1';  //the eventID of the ACK itself is not used
+      payloadBuffer[1] = '0';
+      payloadBuffer[2] = ackBuffer[0][0];
+      payloadBuffer[3] = ackBuffer[0][1];
+      payloadBuffer[4] = 0;
+    }
+
+    void flushReceiver() {}
+
+    IPAddress senderIP() {
+      return targetIP;
+    }
+
+  private:
+    static const byte ackBufferSize = 8;
+    char ackBuffer[ackBufferSize][2];
+    byte ackCount;
+    boolean receiving;
+};
+
+
+SimulatedNetwork simulatedNetwork;
+byte storageBuffer[2 + storageRecordCount * (10 + sendEventLengthMax + sendPayloadLengthMax)];  //2 bytes of header and a record for each stored event
+EtherEventQueueRAM storage(storageBuffer, sizeof(storageBuffer));
+EthernetClient ethernetClient;  //not used by the simulated network
+EthernetServer ethernetServer(port);  //not used by the simulated network
+
+
+void setup() {
+  Serial.begin(9600);
+  EtherEventQueue.setNetwork(simulatedNetwork);
+  EtherEventQueue.setStorage(storage);  //must be set before begin()
+  simulatedReset();
+
+  for (byte count = 0; count < eventCount; count++) {
+    EtherEventQueue.queue(targetNode, port, EtherEventQueue.eventTypeConfirm, F("event"), count);
+  }
+  report(F("queued"));
+
+  simulatedReset();  //the events in the queue are lost, the stored events are kept
+  report(F("reset"));
+
+  handleQueue();  //the stored events that fit in the queue are replayed and sent but the simulated node doesn't ACK them
+  report(F("sent without ACK"));
+
+  simulatedReset();  //the events that were not ACKed are still in the storage
+  report(F("reset"));
+
+  simulatedNetwork.acking = true;
+  handleQueue();  //the events are replayed and sent again, the ACKs remove them from the queue and the storage
+  report(F("sent with ACK"));
+
+  simulatedReset();
+  report(F("reset"));
+}
+
+
+void loop() {}
+
+
+void simulatedReset() {
+  if (EtherEventQueue.begin(0, 2, queueSizeMax, sendEventLengthMax, sendPayloadLengthMax, 10, 10) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+  EtherEventQueue.setNode(targetNode, targetIP);
+  EtherEventQueue.setEventAck(F("ack"));  //must be set before the stored events are replayed
+  EtherEventQueue.setResendDelay(100);
+}
+
+
+void handleQueue() {
+  //the resend delay is longer than the time this takes so each event in the queue is only sent once unless it is replayed again
+  for (byte count = 0; count < eventCount * 2; count++) {
+    EtherEventQueue.queueHandler(ethernetClient);
+    while (EtherEventQueue.availableEvent(ethernetServer) > 0) {  //the example only receives ACKs, which are handled by EtherEventQueue
+      EtherEventQueue.flushReceiver();
+    }
+  }
+}
+
+
+void report(const __FlashStringHelper* step) {
+  Serial.print(step);
+  Serial.print(F(": queue size="));
+  Serial.print(EtherEventQueue.getQueueSize());
+  Serial.print(F(", stored events waiting to be replayed="));
+  Serial.println(EtherEventQueue.getStorageCount());
+}
@@ -0,0 +1,192 @@
+// Example script for the EtherEventQueue library. Demonstrates running EtherEventQueue in a worker thread with EtherEventQueueWorker and benchmarks it against the single-threaded loop.
+// The application computes for a while before queueing each event. The events are sent through a simulated network that takes networkLatency to send each event and echoes it back to the device.
+// In the single-threaded loop the computing and the network wait for each other. With the worker the network runs in its own thread, on another core if there is one, so the sends and receives overlap with the computing.
+// The number of events, the duration and the events per second of each mode are printed to the serial monitor.
+// Requires POSIX threads: ESP32 or Linux. No Ethernet hardware or network is needed.
+
+//These libraries are required by EtherEventQueue:
+#include <SPI.h>
+#include <Ethernet.h>
+#include <MD5.h>
+#include <EtherEvent.h>
+#include <EtherEventQueue.h>
+#include <EtherEventQueueWorker.h>
+
+
+//configuration parameters - modify these values to your desired settings
+const unsigned int eventCount = 200;
+const unsigned long computeDuration = 2000;  //(us)time the application computes before queueing each event
+const unsigned long networkLatency = 2;  //(ms)time the simulated network takes to send an event
+const byte queueSizeMax = 10;
+const byte eventLengthMax = 10;
+const unsigned int payloadLengthMax = 20;
+const unsigned int port = 1024;
+const IPAddress targetIP(192, 168, 69, 105);  //not used by the simulated network
+
+
+//The simulated network waits networkLatency for each send and echoes the event back.
+class EchoNetwork : public EtherEventQueueNetwork {
+  public:
+    byte send(const byte targetIP[], const unsigned int port, const char event[], const char payload[]) {
+      (void)targetIP;
+      (void)port;
+      delay(networkLatency);  //delay() lets other tasks run during the wait like a real network
+      if (echoCount == echoBufferSize) {
+        return 1;  //the echo is lost
+      }
+      echo_t &echo = echoBuffer[(echoHead + echoCount) % echoBufferSize];
+      strncpy(echo.event, event, sizeof(echo.event) - 1);
+      echo.event[sizeof(echo.event) - 1] = 0;
+      strncpy(echo.payload, payload, sizeof(echo.payload) - 1);
+      echo.payload[sizeof(echo.payload) - 1] = 0;
+      echoCount++;
+      return 1;
+    }
+
+    byte availableEvent() {
+      if (receiving) {  //discard the previous echo the same as EtherEvent discards an event that was not read
+        echoHead = (echoHead + 1) % echoBufferSize;
+        echoCount--;
+        receiving = false;
+      }
+      if (echoCount == 0) {
+        return 0;
+      }
+      receiving = true;
+      return strlen(echoBuffer[echoHead].event) + 1;
+    }
+
+    void readEvent(char eventBuffer[]) {
+      strcpy(eventBuffer, echoBuffer[echoHead].event);
+    }
+
+    unsigned int availablePayload() {
+      return strlen(echoBuffer[echoHead].payload) + 1;
+    }
+
+    void readPayload(char payloadBuffer[]) {
+      strcpy(payloadBuffer, echoBuffer[echoHead].payload);
+    }
+
+    void flushReceiver() {}
+
+  private:
+    static const byte echoBufferSize = 16;
+    struct echo_t {
+      char event[eventLengthMax + 1];
+      char payload[payloadLengthMax + 3];  //the payload has the eventID
+    };
+    echo_t echoBuffer[echoBufferSize];
+    byte echoHead;
+    byte echoCount;
+    boolean receiving;
+};
+
+
+EchoNetwork echoNetwork;
+EtherEventQueueWorker worker;
+EthernetClient ethernetClient;  //not used by the simulated network
+EthernetServer ethernetServer(port);  //not used by the simulated network
+volatile unsigned long computeResult;  //prevents the compiler from removing the computation
+
+
+void setup() {
+  Serial.begin(9600);
+  EtherEventQueue.setNetwork(echoNetwork);
+  if (EtherEventQueue.begin(queueSizeMax, eventLengthMax, payloadLengthMax, eventLengthMax, payloadLengthMax) == false) {
+    Serial.print(F("ERROR: Buffer size exceeds available memory, use smaller values."));
+    while (true);  //abort execution of the rest of the program
+  }
+
+  Serial.println(F("mode,events,received,duration(ms),events/s"));
+  unsigned long timestamp = millis();
+  const unsigned int singleThreadReceived = singleThread();
+  report(F("single thread"), singleThreadReceived, millis() - timestamp);
+
+  timestamp = millis();
+  const unsigned int workerReceived = workerThread();
+  report(F("worker"), workerReceived, millis() - timestamp);
+}
+
+
+void loop() {}
+
+
+//everything runs in the sketch loop
+unsigned int singleThread() {
+  unsigned int receivedCount = 0;
+  for (unsigned int counter = 0; counter < eventCount; counter++) {
+    compute();
+    EtherEventQueue.queue(targetIP, port, EtherEventQueue.eventTypeOnce, F("test"), counter);
+    EtherEventQueue.queueHandler(ethernetClient);
+    receivedCount += receiveSingleThread();
+  }
+  while (EtherEventQueue.getQueueSize() > 0) {  //send the rest of the queue
+    EtherEventQueue.queueHandler(ethernetClient);
+    receivedCount += receiveSingleThread();
+  }
+  receivedCount += receiveSingleThread();
+  return receivedCount;
+}
+
+
+unsigned int receiveSingleThread() {
+  unsigned int receivedCount = 0;
+  while (EtherEventQueue.availableEvent(ethernetServer) > 0) {
+    EtherEventQueue.flushReceiver();
+    receivedCount++;
+  }
+  return receivedCount;
+}
+
+
+//the worker thread sends and receives while the sketch computes
+unsigned int workerThread() {
+  if (worker.begin(ethernetClient, ethernetServer, queueSizeMax, eventLengthMax, payloadLengthMax) == false) {
+    Serial.println(F("ERROR: Worker thread could not be started."));
+    return 0;
+  }
+  unsigned int receivedCount = 0;
+  char event[eventLengthMax + 1];
+  char payload[payloadLengthMax + 1];
+  byte eventID;
+  for (unsigned int counter = 0; counter < eventCount; counter++) {
+    compute();
+    while (worker.queue(targetIP, port, EtherEventQueue.eventTypeOnce, F("test"), counter) == false) {  //all slots are used
+      if (worker.receive(event, payload, eventID, 1)) {
+        receivedCount++;
+      }
+    }
+    while (worker.receive(event, payload, eventID)) {
+      receivedCount++;
+    }
+  }
+  while (receivedCount < eventCount && worker.receive(event, payload, eventID, 1000)) {  //wait for the rest of the echoes
+    receivedCount++;
+  }
+  worker.end();
+  return receivedCount;
+}
+
+
+void compute() {
+  const unsigned long timestamp = micros();
+  unsigned long result = 0;
+  while (micros() - timestamp < computeDuration) {
+    result = result * 31 + 7;
+  }
+  computeResult = result;
+}
+
+
+void report(const __FlashStringHelper* mode, const unsigned int receivedCount, const unsigned long duration) {
+  Serial.print(mode);
+  Serial.print(',');
+  Serial.print(eventCount);
+  Serial.print(',');
+  Serial.print(receivedCount);
+  Serial.print(',');
+  Serial.print(duration);
+  Serial.print(',');
+  Serial.println(duration > 0 ? 1000.0 * eventCount / duration : 0.0);
+}